@@ -3,7 +3,7 @@ LOCAL_PATH := $(call my-dir)
 include $(CLEAR_VARS)
 
 LOCAL_MODULE    := dvbt2_sender
-LOCAL_SRC_FILES := dvbt2_sender.c
+LOCAL_SRC_FILES := dvbt2_sender.c dvbt2_abs_capture.c dvbt2_record.c
 LOCAL_SHARED_LIBRARIES := gstreamer_android
 LOCAL_LDLIBS := -llog -landroid
 include $(BUILD_SHARED_LIBRARY)
@@ -32,6 +32,8 @@ GSTREAMER_NDK_BUILD_PATH  := $(GSTREAMER_ROOT)/share/gst-android/ndk-build/
 include $(GSTREAMER_NDK_BUILD_PATH)/plugins.mk
 GSTREAMER_EXTRA_LIBS      := -liconv
 GSTREAMER_PLUGINS         := $(GSTREAMER_PLUGINS_CORE) $(GSTREAMER_PLUGINS_PLAYBACK) $(GSTREAMER_PLUGINS_SYS) $(GSTREAMER_PLUGINS_CODECS) $(GSTREAMER_PLUGINS_CODECS_RESTRICTED) $(GSTREAMER_PLUGINS_NET)
+# splitmuxsink, for the recording branch (dvbt2_record.c)
+GSTREAMER_PLUGINS         += multifile
 G_IO_MODULES              := openssl
-GSTREAMER_EXTRA_DEPS      := gstreamer-video-1.0 glib-2.0 gstreamer-app-1.0 gobject-2.0
+GSTREAMER_EXTRA_DEPS      := gstreamer-video-1.0 gstreamer-rtp-1.0 glib-2.0 gstreamer-app-1.0 gobject-2.0
 include $(GSTREAMER_NDK_BUILD_PATH)/gstreamer-1.0.mk
\ No newline at end of file
@@ -0,0 +1,349 @@
+#include <string.h>
+#include <time.h>
+#include <gst/rtp/gstrtpbuffer.h>
+#include <gst/rtp/gstrtphdrext.h>
+#include "dvbt2_abs_capture.h"
+#include "dvbt2_pipeline.h"
+
+#define TAG "dvbt2_abs_capture"
+
+GST_DEBUG_CATEGORY_STATIC (debug_category);
+
+#define GST_CAT_DEFAULT debug_category
+
+/* Seconds between the NTP epoch (1900) and the unix epoch (1970) */
+#define NTP_UNIX_OFFSET G_GUINT64_CONSTANT (2208988800)
+/* Size of the extension payload: capture timestamp only, the optional clock offset is not sent */
+#define ABS_CAPTURE_TIME_SIZE 8
+
+/* Header extension written by RTP_VIDEO_PAY: rtpbasepayload puts extmap-<id>=ABS_CAPTURE_TIME_URI in its
+ * src caps, so receivers can find the id */
+typedef struct _AbsCaptureExt {
+    GstRTPHeaderExtension parent;
+    AbsCaptureProbe *probe;
+} AbsCaptureExt;
+
+typedef struct _AbsCaptureExtClass {
+    GstRTPHeaderExtensionClass parent_class;
+} AbsCaptureExtClass;
+
+G_DEFINE_TYPE (AbsCaptureExt, abs_capture_ext, GST_TYPE_RTP_HEADER_EXTENSION);
+
+/*
+ * Private methods
+ */
+
+static guint64 unix_ns_to_ntp (guint64 ns)
+{
+    guint64 seconds = ns / GST_SECOND + NTP_UNIX_OFFSET;
+    guint64 fraction = ((ns % GST_SECOND) << 32) / GST_SECOND;
+    return (seconds << 32) | fraction;
+}
+
+static guint64 ntp_to_unix_ns (guint64 ntp)
+{
+    guint64 seconds = (ntp >> 32) - NTP_UNIX_OFFSET;
+    guint64 fraction = ntp & G_GUINT64_CONSTANT (0xffffffff);
+    return seconds * GST_SECOND + ((fraction * GST_SECOND + G_GUINT64_CONSTANT (0x80000000)) >> 32);
+}
+
+/* Map a buffer PTS (running time) to wall-clock, using the clock of element */
+static guint64 pts_to_wall_clock (GstElement * element, GstClockTime pts, guint64 wall)
+{
+    GstClock *clock = element ? gst_element_get_clock (element) : NULL;
+    GstClockTime running;
+
+    if (!clock)
+        return wall;
+    running = gst_clock_get_time (clock) - gst_element_get_base_time (element);
+    gst_object_unref (clock);
+    return running > pts ? wall - (running - pts) : wall;
+}
+
+/* Most recent ring entry for pts, NULL if it already dropped out. Call with lock held */
+static FrameTiming * find_timing (AbsCaptureProbe * probe, GstClockTime pts)
+{
+    for (guint i = 1; i <= ABS_CAPTURE_RING_SIZE; ++i) {
+        FrameTiming *timing = &probe->ring[(probe->head + ABS_CAPTURE_RING_SIZE - i) % ABS_CAPTURE_RING_SIZE];
+        if (timing->pts == pts)
+            return timing;
+    }
+    return NULL;
+}
+
+/* A new frame reached the tee: fix its capture time once, every later stage looks it up by PTS */
+static GstPadProbeReturn source_probe_cb (GstPad * pad, GstPadProbeInfo * info, AbsCaptureProbe * probe)
+{
+    GstClockTime pts = GST_BUFFER_PTS (GST_PAD_PROBE_INFO_BUFFER (info));
+    guint64 wall;
+    FrameTiming *timing;
+
+    if (!g_atomic_int_get (&probe->active) || !GST_CLOCK_TIME_IS_VALID (pts))
+        return GST_PAD_PROBE_OK;
+
+    wall = abs_capture_wall_clock ();
+    g_mutex_lock (&probe->lock);
+    timing = &probe->ring[probe->head];
+    memset (timing, 0, sizeof (FrameTiming));
+    timing->pts = pts;
+    timing->capture = pts_to_wall_clock (GST_PAD_PARENT (pad), pts, wall);
+    timing->source = wall;
+    probe->head = (probe->head + 1) % ABS_CAPTURE_RING_SIZE;
+    g_mutex_unlock (&probe->lock);
+    return GST_PAD_PROBE_OK;
+}
+
+static void mark_stage (AbsCaptureProbe * probe, GstBuffer * buffer, gsize offset)
+{
+    GstClockTime pts = GST_BUFFER_PTS (buffer);
+    guint64 wall = abs_capture_wall_clock ();
+    FrameTiming *timing;
+
+    g_mutex_lock (&probe->lock);
+    if ((timing = find_timing (probe, pts))) {
+        G_STRUCT_MEMBER (guint64, timing, offset) = wall;
+    }
+    g_mutex_unlock (&probe->lock);
+}
+
+static GstPadProbeReturn encoder_in_probe_cb (GstPad * pad, GstPadProbeInfo * info, AbsCaptureProbe * probe)
+{
+    if (g_atomic_int_get (&probe->active))
+        mark_stage (probe, GST_PAD_PROBE_INFO_BUFFER (info), G_STRUCT_OFFSET (FrameTiming, encoder_in));
+    return GST_PAD_PROBE_OK;
+}
+
+/* x264enc keeps the input PTS on the encoded frame (tune=zerolatency, no frame reordering) */
+static GstPadProbeReturn encoder_out_probe_cb (GstPad * pad, GstPadProbeInfo * info, AbsCaptureProbe * probe)
+{
+    if (g_atomic_int_get (&probe->active))
+        mark_stage (probe, GST_PAD_PROBE_INFO_BUFFER (info), G_STRUCT_OFFSET (FrameTiming, encoder_out));
+    return GST_PAD_PROBE_OK;
+}
+
+static GstRTPHeaderExtensionFlags abs_capture_ext_get_supported_flags (GstRTPHeaderExtension * ext)
+{
+    return GST_RTP_HEADER_EXTENSION_ONE_BYTE | GST_RTP_HEADER_EXTENSION_TWO_BYTE;
+}
+
+static gsize abs_capture_ext_get_max_size (GstRTPHeaderExtension * ext, const GstBuffer * input_meta)
+{
+    return ABS_CAPTURE_TIME_SIZE;
+}
+
+/* Called by the payloader for every packet, input_meta is the encoded frame. 0 = not added (inactive) */
+static gssize abs_capture_ext_write (GstRTPHeaderExtension * ext, const GstBuffer * input_meta,
+                                     GstRTPHeaderExtensionFlags write_flags, GstBuffer * output,
+                                     guint8 * data, gsize size)
+{
+    AbsCaptureProbe *probe = ((AbsCaptureExt *) ext)->probe;
+    GstClockTime pts = GST_BUFFER_PTS (input_meta);
+    guint64 capture = 0;
+    FrameTiming *timing;
+
+    if (!g_atomic_int_get (&probe->active) || !GST_CLOCK_TIME_IS_VALID (pts) || size < ABS_CAPTURE_TIME_SIZE)
+        return 0;
+
+    g_mutex_lock (&probe->lock);
+    if ((timing = find_timing (probe, pts)))
+        capture = timing->capture;
+    g_mutex_unlock (&probe->lock);
+
+    /* Frame passed the tee before the probe was activated */
+    if (!capture)
+        capture = pts_to_wall_clock (probe->payloader, pts, abs_capture_wall_clock ());
+
+    GST_WRITE_UINT64_BE (data, unix_ns_to_ntp (capture));
+    return ABS_CAPTURE_TIME_SIZE;
+}
+
+/* Send only: received packets are parsed with abs_capture_parse_packet */
+static gboolean abs_capture_ext_read (GstRTPHeaderExtension * ext, GstRTPHeaderExtensionFlags read_flags,
+                                      const guint8 * data, gsize size, GstBuffer * buffer)
+{
+    return TRUE;
+}
+
+static void abs_capture_ext_class_init (AbsCaptureExtClass * klass)
+{
+    GstRTPHeaderExtensionClass *ext_class = GST_RTP_HEADER_EXTENSION_CLASS (klass);
+
+    ext_class->get_supported_flags = abs_capture_ext_get_supported_flags;
+    ext_class->get_max_size = abs_capture_ext_get_max_size;
+    ext_class->write = abs_capture_ext_write;
+    ext_class->read = abs_capture_ext_read;
+    gst_element_class_set_static_metadata (GST_ELEMENT_CLASS (klass), "Absolute capture time",
+                                           GST_RTP_HDREXT_ELEMENT_CLASS,
+                                           "Capture wall-clock time of the frame, as NTP timestamp", "dvbt2");
+    gst_rtp_header_extension_class_set_uri (ext_class, ABS_CAPTURE_TIME_URI);
+}
+
+static void abs_capture_ext_init (AbsCaptureExt * ext)
+{
+}
+
+/* Packets leave after the extension is written: note when the last one (marker bit) of the frame did */
+static void mark_payload_out (AbsCaptureProbe * probe, GstBuffer * buffer)
+{
+    GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+    gboolean marker;
+
+    if (!gst_rtp_buffer_map (buffer, GST_MAP_READ, &rtp))
+        return;
+    marker = gst_rtp_buffer_get_marker (&rtp);
+    gst_rtp_buffer_unmap (&rtp);
+    if (marker)
+        mark_stage (probe, buffer, G_STRUCT_OFFSET (FrameTiming, payload_out));
+}
+
+/* Single buffers and RTP_VIDEO_PAY lists alike */
+static GstPadProbeReturn payload_probe_cb (GstPad * pad, GstPadProbeInfo * info, AbsCaptureProbe * probe)
+{
+    if (!g_atomic_int_get (&probe->active))
+        return GST_PAD_PROBE_OK;
+
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+        mark_payload_out (probe, GST_PAD_PROBE_INFO_BUFFER (info));
+    } else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+        guint len = gst_buffer_list_length (list);
+        for (guint i = 0; i < len; ++i) {
+            mark_payload_out (probe, gst_buffer_list_get (list, i));
+        }
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static gboolean add_probe (GstElement * pipeline, const gchar * name, const gchar * pad_name,
+                           GstPadProbeType type, GstPadProbeCallback callback, AbsCaptureProbe * probe)
+{
+    GstElement *element = gst_bin_get_by_name (GST_BIN (pipeline), name);
+    GstPad *pad;
+
+    if (!element) {
+        GST_ERROR ("Could not retrieve %s", name);
+        return FALSE;
+    }
+    pad = gst_element_get_static_pad (element, pad_name);
+    gst_pad_add_probe (pad, type, callback, probe, NULL);
+    gst_object_unref (pad);
+    gst_object_unref (element);
+    return TRUE;
+}
+
+/*
+ * Public methods
+ */
+
+guint64 abs_capture_wall_clock (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_REALTIME, &ts);
+    return (guint64) ts.tv_sec * GST_SECOND + ts.tv_nsec;
+}
+
+AbsCaptureProbe * abs_capture_probe_new (GstElement * pipeline, guint8 ext_id)
+{
+    AbsCaptureProbe *probe;
+    AbsCaptureExt *ext;
+    GstElement *tee, *encoder, *payloader;
+
+    GST_DEBUG_CATEGORY_INIT (debug_category, TAG, 0, "DVBT2-SENDER abs-capture-time");
+
+    /* Check all elements first, so no probe is left behind pointing to freed memory */
+    tee = gst_bin_get_by_name (GST_BIN (pipeline), VIDEO_TEE);
+    encoder = gst_bin_get_by_name (GST_BIN (pipeline), VIDEO_ENCODER);
+    payloader = gst_bin_get_by_name (GST_BIN (pipeline), RTP_VIDEO_PAY);
+    if (!tee || !encoder || !payloader) {
+        GST_ERROR ("Pipeline has no %s/%s/%s, latency probe disabled", VIDEO_TEE, VIDEO_ENCODER, RTP_VIDEO_PAY);
+        g_clear_object (&tee);
+        g_clear_object (&encoder);
+        g_clear_object (&payloader);
+        return NULL;
+    }
+    gst_object_unref (tee);
+    gst_object_unref (encoder);
+
+    probe = g_new0 (AbsCaptureProbe, 1);
+    g_mutex_init (&probe->lock);
+    probe->ext_id = ext_id;
+    probe->payloader = payloader;
+    for (int i = 0; i < ABS_CAPTURE_RING_SIZE; ++i) {
+        probe->ring[i].pts = GST_CLOCK_TIME_NONE;
+    }
+
+    add_probe (pipeline, VIDEO_TEE, "sink", GST_PAD_PROBE_TYPE_BUFFER,
+               (GstPadProbeCallback) source_probe_cb, probe);
+    add_probe (pipeline, VIDEO_ENCODER, "sink", GST_PAD_PROBE_TYPE_BUFFER,
+               (GstPadProbeCallback) encoder_in_probe_cb, probe);
+    add_probe (pipeline, VIDEO_ENCODER, "src", GST_PAD_PROBE_TYPE_BUFFER,
+               (GstPadProbeCallback) encoder_out_probe_cb, probe);
+    add_probe (pipeline, RTP_VIDEO_PAY, "src", GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+               (GstPadProbeCallback) payload_probe_cb, probe);
+
+    /* Before the payloader negotiates, so the extmap is in its first caps */
+    ext = g_object_new (abs_capture_ext_get_type (), NULL);
+    ext->probe = probe;
+    gst_rtp_header_extension_set_id (GST_RTP_HEADER_EXTENSION (ext), ext_id);
+    g_signal_emit_by_name (payloader, "add-extension", ext);
+    gst_object_unref (ext);
+    GST_DEBUG ("Latency probe installed, extension id %d (%s)", ext_id, ABS_CAPTURE_TIME_URI);
+    return probe;
+}
+
+void abs_capture_probe_free (AbsCaptureProbe * probe)
+{
+    if (!probe)
+        return;
+    /* The extension points to probe */
+    g_signal_emit_by_name (probe->payloader, "clear-extensions");
+    gst_object_unref (probe->payloader);
+    g_mutex_clear (&probe->lock);
+    g_free (probe);
+}
+
+void abs_capture_probe_set_active (AbsCaptureProbe * probe, gboolean active)
+{
+    GST_DEBUG ("Latency probe %s", active ? "enabled" : "disabled");
+    g_atomic_int_set (&probe->active, active ? 1 : 0);
+}
+
+gboolean abs_capture_probe_lookup (AbsCaptureProbe * probe, guint64 capture, FrameTiming * timing)
+{
+    gboolean found = FALSE;
+
+    g_mutex_lock (&probe->lock);
+    for (guint i = 0; i < ABS_CAPTURE_RING_SIZE; ++i) {
+        FrameTiming *entry = &probe->ring[i];
+        /* The NTP round trip may be off by a nanosecond */
+        if (GST_CLOCK_TIME_IS_VALID (entry->pts) && entry->capture + 1 >= capture && entry->capture <= capture + 1) {
+            *timing = *entry;
+            found = TRUE;
+            break;
+        }
+    }
+    g_mutex_unlock (&probe->lock);
+    return found;
+}
+
+gboolean abs_capture_parse_packet (const guint8 * packet, gsize size, guint8 ext_id,
+                                   guint64 * capture, gboolean * marker)
+{
+    GstBuffer *buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY, (gpointer) packet, size, 0, size, NULL, NULL);
+    GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+    gpointer data;
+    guint data_size;
+    gboolean found = FALSE;
+
+    if (gst_rtp_buffer_map (buffer, GST_MAP_READ, &rtp)) {
+        *marker = gst_rtp_buffer_get_marker (&rtp);
+        if (gst_rtp_buffer_get_extension_onebyte_header (&rtp, ext_id, 0, &data, &data_size)
+            && data_size >= ABS_CAPTURE_TIME_SIZE) {
+            *capture = ntp_to_unix_ns (GST_READ_UINT64_BE (data));
+            found = TRUE;
+        }
+        gst_rtp_buffer_unmap (&rtp);
+    }
+    gst_buffer_unref (buffer);
+    return found;
+}
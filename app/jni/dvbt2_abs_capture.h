@@ -0,0 +1,65 @@
+#ifndef NAMIDTVBT2EXAMPLE_DVBT2_ABS_CAPTURE_H
+#define NAMIDTVBT2EXAMPLE_DVBT2_ABS_CAPTURE_H
+
+#include <gst/gst.h>
+
+/**
+ * Glass-to-glass latency probe.
+ * Writes the capture wall-clock time of every video frame into the RTP packets leaving
+ * RTP_VIDEO_PAY, using the absolute capture time header extension (8 byte payload: NTP UQ32.32
+ * timestamp, no clock offset). The extension is attached to the payloader (add-extension), which
+ * advertises it as extmap-<ext_id>=ABS_CAPTURE_TIME_URI in its src caps: put that in the SDP handed
+ * to receivers. A receiver with a synchronized clock computes sender -> receiver latency from it.
+ *
+ * Along the way the probe keeps the wall-clock time each recent frame passed the tee,
+ * entered and left VIDEO_ENCODER and left RTP_VIDEO_PAY, so a receiver running in the same
+ * process (host/dvbt2_latency.c) can split the latency into stages.
+ *
+ * Shared by the Android library and the host target: no JNI here.
+ */
+
+#define ABS_CAPTURE_TIME_URI "http://www.webrtc.org/experiments/rtp-hdrext/abs-capture-time"
+#define ABS_CAPTURE_TIME_EXT_ID 1
+/* Recent frames kept for stage lookup, must cover the frames in flight between tee and receiver */
+#define ABS_CAPTURE_RING_SIZE 256
+
+/* Wall-clock times (CLOCK_REALTIME, ns) of one video frame along the sender pipeline */
+typedef struct _FrameTiming {
+    GstClockTime pts;
+    guint64 capture;      /* Frame PTS mapped to wall-clock: when the source captured it */
+    guint64 source;       /* Frame reached the tee */
+    guint64 encoder_in;   /* Frame reached the encoder, after queue and videoconvert */
+    guint64 encoder_out;  /* Encoded frame left the encoder */
+    guint64 payload_out;  /* Last RTP packet (marker bit) of the frame left the payloader, 0 until then */
+} FrameTiming;
+
+typedef struct _AbsCaptureProbe {
+    GMutex lock;
+    guint8 ext_id;
+    GstElement *payloader;  /* RTP_VIDEO_PAY, carries the header extension */
+    gint active;          /* Extension and timing are only written while set, see abs_capture_probe_set_active */
+    FrameTiming ring[ABS_CAPTURE_RING_SIZE];
+    guint head;           /* Next slot to write */
+} AbsCaptureProbe;
+
+/* Install the probes on the video tee, encoder and payloader of pipeline and attach the header
+ * extension to the payloader. Call before the pipeline negotiates (NULL/READY). Starts inactive.
+ * Returns NULL if one of those elements is missing. Free only once the pipeline is in NULL state */
+AbsCaptureProbe * abs_capture_probe_new (GstElement * pipeline, guint8 ext_id);
+
+void abs_capture_probe_free (AbsCaptureProbe * probe);
+
+/* Turn the header extension on or off, safe to call from any thread while playing */
+void abs_capture_probe_set_active (AbsCaptureProbe * probe, gboolean active);
+
+/* Find the sender side timing of the frame captured at capture (as carried in the extension) */
+gboolean abs_capture_probe_lookup (AbsCaptureProbe * probe, guint64 capture, FrameTiming * timing);
+
+/* Parse a received RTP packet. Returns FALSE if it is not RTP or does not carry the extension */
+gboolean abs_capture_parse_packet (const guint8 * packet, gsize size, guint8 ext_id,
+                                   guint64 * capture, gboolean * marker);
+
+/* Current CLOCK_REALTIME in ns */
+guint64 abs_capture_wall_clock (void);
+
+#endif //NAMIDTVBT2EXAMPLE_DVBT2_ABS_CAPTURE_H
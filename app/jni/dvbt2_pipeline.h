@@ -0,0 +1,81 @@
+#ifndef NAMIDTVBT2EXAMPLE_DVBT2_PIPELINE_H
+#define NAMIDTVBT2EXAMPLE_DVBT2_PIPELINE_H
+
+/*
+ * Pipeline descriptions shared by the Android library (dvbt2_sender.c) and the
+ * Linux host target (host/). Keep this header free of JNI and Android includes.
+ */
+
+/**
+ * Have 2 tee line with
+ * Queue name for each tee is "tee1", "tee2"
+ * Output for each sync is "vsink1", "vsink2"
+ */
+#define VSYNC_0 "vsink0"
+#define VSYNC_1 "vsink1"
+#define VALVE   "valve"
+#define UDP_VIDEO_SINK "v_udp_sink"
+#define UDP_AUDIO_SINK "a_udp_sink"
+#define VIDEO_TEE      "t"
+#define VIDEO_ENCODER  "v_encoder"
+/* Pushes buffer lists for frames split over several packets: probes at or after it take BUFFER and BUFFER_LIST */
+#define RTP_VIDEO_PAY  "v_rtp_pay"
+/* Encoded streams are teed before the payloaders, so the recording branch (dvbt2_record.c) reuses them */
+#define VIDEO_ENC_TEE  "v_enc_tee"
+#define AUDIO_ENC_TEE  "a_enc_tee"
+
+#define PIPELINE_NAMI_VIDEOTEST "gltestsrc ! glupload ! " \
+    /* Raise source framerate cap to 30fps (if camera supports it). */ \
+    "tee name="VIDEO_TEE" " \
+    /* FMMD preview branch: same idea */ \
+    "t. ! queue name=t0 ! " \
+    "glcolorconvert ! glimagesink name="VSYNC_0" " \
+    /* DW preview branch: small, leaky queue keeps UI responsive */ \
+    "t. ! queue name=t1 ! " \
+    "glcolorconvert ! glimagesink name="VSYNC_1" " \
+    /* Multi up sink for the registed ip address */ \
+    "t. ! queue name=t2 ! " \
+    "glcolorconvert ! gldownload ! video/x-raw,format=I420 ! x264enc name="VIDEO_ENCODER" tune=zerolatency ! tee name="VIDEO_ENC_TEE" ! rtph264pay name="RTP_VIDEO_PAY" ! " \
+    "multiudpsink name="UDP_VIDEO_SINK" sync=true async=false " \
+    "openslessrc ! audioconvert ! voaacenc ! tee name="AUDIO_ENC_TEE" ! rtpmp4gpay ! "        \
+    "multiudpsink name="UDP_AUDIO_SINK" sync=true async=false "        \
+
+#define PIPELINE_NAMI_DVBT2 "ahcsrc device=0 ! video/x-raw,width=1920,height=1080,framerate=30/1 ! " \
+    /* Raise source framerate cap to 30fps (if camera supports it). */ \
+    "tee name="VIDEO_TEE" " \
+    /* FMMD preview branch: same idea */ \
+    "t. ! queue name=t0 ! " \
+    "videoconvert ! glimagesink name="VSYNC_0" sync=false async=false " \
+    /* DW preview branch: small, leaky queue keeps UI responsive */ \
+    "t. ! queue name=t1 ! " \
+    "videoconvert ! glimagesink name="VSYNC_1" sync=false async=false " \
+    /* Multi up sink for the registed ip address */ \
+    "t. ! queue name=t2 ! " \
+    "videoconvert ! x264enc name="VIDEO_ENCODER" tune=zerolatency ! tee name="VIDEO_ENC_TEE" ! rtph264pay name="RTP_VIDEO_PAY" ! " \
+    "multiudpsink name="UDP_VIDEO_SINK" sync=true async=false " \
+    "openslessrc ! audioconvert ! voaacenc ! tee name="AUDIO_ENC_TEE" ! rtpmp4gpay ! " \
+    "multiudpsink name="UDP_AUDIO_SINK" sync=true async=false " \
+
+/**
+ * Headless variant for the Linux host target: same tee layout and element names,
+ * with videotestsrc/audiotestsrc in place of ahcsrc/openslessrc and fakesinks in
+ * place of the GL sinks. Format arguments, in order:
+ *   width (int), height (int), framerate (int),
+ *   x264 speed-preset (string), bitrate in kbit/s (int), key-int-max (int)
+ */
+#define PIPELINE_NAMI_HEADLESS "videotestsrc is-live=true ! video/x-raw,width=%d,height=%d,framerate=%d/1 ! " \
+    "tee name="VIDEO_TEE" " \
+    /* FMMD preview branch */ \
+    "t. ! queue name=t0 ! " \
+    "videoconvert ! fakesink name="VSYNC_0" sync=false async=false " \
+    /* DW preview branch */ \
+    "t. ! queue name=t1 ! " \
+    "videoconvert ! fakesink name="VSYNC_1" sync=false async=false " \
+    /* Multi up sink for the registed ip address */ \
+    "t. ! queue name=t2 ! " \
+    "videoconvert ! x264enc name="VIDEO_ENCODER" tune=zerolatency speed-preset=%s bitrate=%d key-int-max=%d ! tee name="VIDEO_ENC_TEE" ! rtph264pay name="RTP_VIDEO_PAY" ! " \
+    "multiudpsink name="UDP_VIDEO_SINK" sync=true async=false " \
+    "audiotestsrc is-live=true ! audioconvert ! voaacenc ! tee name="AUDIO_ENC_TEE" ! rtpmp4gpay ! " \
+    "multiudpsink name="UDP_AUDIO_SINK" sync=true async=false " \
+
+#endif //NAMIDTVBT2EXAMPLE_DVBT2_PIPELINE_H
@@ -0,0 +1,463 @@
+#include <string.h>
+#include <gst/video/video.h>
+#include "dvbt2_record.h"
+#include "dvbt2_pipeline.h"
+
+#define TAG "dvbt2_record"
+/* Name of the recording branch bin */
+#define RECORD_BIN "record_bin"
+
+GST_DEBUG_CATEGORY_STATIC (debug_category);
+
+#define GST_CAT_DEFAULT debug_category
+
+typedef enum _RecordStream {
+    RECORD_VIDEO,
+    RECORD_AUDIO,
+    RECORD_STREAM_MAX,
+} RecordStream;
+
+/*
+ * Private methods
+ */
+
+static gboolean is_keyframe (GstBuffer * buffer)
+{
+    return !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+}
+
+/* Ask x264enc for an IDR frame as soon as possible, safe from streaming threads */
+static void request_keyframe (Recorder * recorder)
+{
+    gst_element_send_event (recorder->encoder,
+                            gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE, TRUE, 0));
+}
+
+/* TRUE if object is bin or one of its children. Only compares bin, never dereferences it */
+static gboolean in_branch (GstObject * object, GstElement * bin)
+{
+    return bin && object && gst_object_has_as_ancestor (object, GST_OBJECT (bin));
+}
+
+/* Runs once the tee pushes nothing through pad: unlink it, then close that input of the now detached
+ * branch. The tee never sees the EOS, so the live stream keeps flowing */
+static GstPadProbeReturn detach_probe_cb (GstPad * pad, GstPadProbeInfo * info, Recorder * recorder)
+{
+    GstPad *peer = gst_pad_get_peer (pad);
+
+    /* Already unlinked by teardown_branch */
+    if (!peer)
+        return GST_PAD_PROBE_REMOVE;
+    gst_pad_unlink (pad, peer);
+    gst_pad_send_event (peer, gst_event_new_eos ());
+    gst_object_unref (peer);
+    return GST_PAD_PROBE_REMOVE;
+}
+
+/* Draining: drop, and detach this tee pad once (called from its own streaming thread, so pad is alive) */
+static GstPadProbeReturn drain_tee_pad (GstPad * pad, Recorder * recorder, RecordStream stream)
+{
+    if (g_atomic_int_compare_and_exchange (&recorder->detaching[stream], 0, 1))
+        gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_IDLE, (GstPadProbeCallback) detach_probe_cb, recorder, NULL);
+    return GST_PAD_PROBE_DROP;
+}
+
+/* Video from VIDEO_ENC_TEE: start on a keyframe, stop (detach from the tees) on a keyframe.
+ * Never takes recorder->lock: teardown_branch holds it while releasing the tee pads */
+static GstPadProbeReturn video_tee_probe_cb (GstPad * pad, GstPadProbeInfo * info, Recorder * recorder)
+{
+    gboolean keyframe = is_keyframe (GST_PAD_PROBE_INFO_BUFFER (info));
+
+    switch (g_atomic_int_get (&recorder->state)) {
+        case RECORD_WAITING_KEY:
+            if (!keyframe)
+                return GST_PAD_PROBE_DROP;
+            /* Lost to recorder_stop (WAITING_KEY -> IDLE): the branch is being torn down, keep it empty */
+            if (!g_atomic_int_compare_and_exchange (&recorder->state, RECORD_WAITING_KEY, RECORD_RECORDING))
+                return GST_PAD_PROBE_DROP;
+            GST_DEBUG ("Keyframe reached, recording");
+            return GST_PAD_PROBE_OK;
+        case RECORD_RECORDING:
+            return GST_PAD_PROBE_OK;
+        case RECORD_STOPPING:
+            if (!keyframe)
+                return GST_PAD_PROBE_OK;
+            if (!g_atomic_int_compare_and_exchange (&recorder->state, RECORD_STOPPING, RECORD_DRAINING))
+                return GST_PAD_PROBE_DROP;
+            GST_DEBUG ("Keyframe reached, closing the recording");
+            return drain_tee_pad (pad, recorder, RECORD_VIDEO);
+        case RECORD_DRAINING:
+            return drain_tee_pad (pad, recorder, RECORD_VIDEO);
+        default:
+            return GST_PAD_PROBE_DROP;
+    }
+}
+
+/* Audio from AUDIO_ENC_TEE follows the video: only while the video is being recorded */
+static GstPadProbeReturn audio_tee_probe_cb (GstPad * pad, GstPadProbeInfo * info, Recorder * recorder)
+{
+    switch (g_atomic_int_get (&recorder->state)) {
+        case RECORD_RECORDING:
+        case RECORD_STOPPING:
+            return GST_PAD_PROBE_OK;
+        case RECORD_DRAINING:
+            return drain_tee_pad (pad, recorder, RECORD_AUDIO);
+        default:
+            return GST_PAD_PROBE_DROP;
+    }
+}
+
+/* After the handoff queue dropped video, hold back delta frames until the next keyframe */
+static GstPadProbeReturn video_resync_probe_cb (GstPad * pad, GstPadProbeInfo * info, Recorder * recorder)
+{
+    if (!g_atomic_int_get (&recorder->resync))
+        return GST_PAD_PROBE_OK;
+    if (!is_keyframe (GST_PAD_PROBE_INFO_BUFFER (info)))
+        return GST_PAD_PROBE_DROP;
+    GST_DEBUG ("Recording resynchronized on keyframe");
+    g_atomic_int_set (&recorder->resync, 0);
+    return GST_PAD_PROBE_OK;
+}
+
+/* Emitted from the tee thread when the handoff queue is full, right before it leaks */
+static void video_overrun_cb (GstElement * queue, Recorder * recorder)
+{
+    g_mutex_lock (&recorder->stats_lock);
+    recorder->stats.overruns++;
+    g_mutex_unlock (&recorder->stats_lock);
+    if (g_atomic_int_compare_and_exchange (&recorder->resync, 0, 1)) {
+        GST_WARNING ("Recording video queue overrun, dropping until next keyframe");
+        request_keyframe (recorder);
+    }
+}
+
+static void audio_overrun_cb (GstElement * queue, Recorder * recorder)
+{
+    g_mutex_lock (&recorder->stats_lock);
+    recorder->stats.overruns++;
+    g_mutex_unlock (&recorder->stats_lock);
+}
+
+static GstPadProbeReturn filesink_probe_cb (GstPad * pad, GstPadProbeInfo * info, Recorder * recorder)
+{
+    gsize size = 0;
+
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER)
+        size = gst_buffer_get_size (GST_PAD_PROBE_INFO_BUFFER (info));
+    else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+        size = gst_buffer_list_calculate_size (GST_PAD_PROBE_INFO_BUFFER_LIST (info));
+    g_mutex_lock (&recorder->stats_lock);
+    recorder->stats.bytes += size;
+    g_mutex_unlock (&recorder->stats_lock);
+    return GST_PAD_PROBE_OK;
+}
+
+/* Errors are posted synchronously before the flow error travels back up to the queues:
+ * flag the branch here so the tee probes drop everything and the tees never see that error */
+static void sync_error_cb (GstBus * bus, GstMessage * msg, Recorder * recorder)
+{
+    if (in_branch (GST_MESSAGE_SRC (msg), g_atomic_pointer_get (&recorder->bin))) {
+        g_atomic_int_set (&recorder->state, RECORD_FAILED);
+    }
+}
+
+static void add_probe (GstElement * element, const gchar * pad_name, GstPadProbeType type,
+                       GstPadProbeCallback callback, Recorder * recorder)
+{
+    GstPad *pad = gst_element_get_static_pad (element, pad_name);
+    gst_pad_add_probe (pad, type, callback, recorder, NULL);
+    gst_object_unref (pad);
+}
+
+static GstElement * make_queue (RecordStream stream, guint64 queue_time, Recorder * recorder)
+{
+    GstElement *queue = gst_element_factory_make ("queue", stream == RECORD_VIDEO ? "record_vqueue" : "record_aqueue");
+
+    if (!queue)
+        return NULL;
+    g_object_set (queue, "leaky", 2 /* downstream: drop the oldest */, "max-size-buffers", 0, "max-size-bytes", 0,
+                  "max-size-time", queue_time ? queue_time : RECORD_DEFAULT_QUEUE_TIME, NULL);
+    g_signal_connect (queue, "overrun",
+                      stream == RECORD_VIDEO ? G_CALLBACK (video_overrun_cb) : G_CALLBACK (audio_overrun_cb), recorder);
+    return queue;
+}
+
+/* Build the recording branch bin, with "video_sink" and "audio_sink" ghost pads */
+static GstElement * make_branch (Recorder * recorder, const RecordConfig * config)
+{
+    GstElement *queue[RECORD_STREAM_MAX], *parser[RECORD_STREAM_MAX];
+    GstElement *splitmux, *muxer, *sink, *bin;
+    GstPad *pad;
+
+    queue[RECORD_VIDEO] = make_queue (RECORD_VIDEO, config->queue_time, recorder);
+    queue[RECORD_AUDIO] = make_queue (RECORD_AUDIO, config->queue_time, recorder);
+    parser[RECORD_VIDEO] = gst_element_factory_make ("h264parse", NULL);
+    parser[RECORD_AUDIO] = gst_element_factory_make ("aacparse", NULL);
+    splitmux = gst_element_factory_make ("splitmuxsink", NULL);
+    muxer = gst_element_factory_make (config->format == RECORD_FORMAT_TS ? "mpegtsmux" : "mp4mux", NULL);
+    sink = gst_element_factory_make ("filesink", NULL);
+    if (!queue[RECORD_VIDEO] || !queue[RECORD_AUDIO] || !parser[RECORD_VIDEO] || !parser[RECORD_AUDIO]
+        || !splitmux || !muxer || !sink) {
+        GST_ERROR ("Missing element for the recording branch (queue/h264parse/aacparse/splitmuxsink/%s/filesink)",
+                   config->format == RECORD_FORMAT_TS ? "mpegtsmux" : "mp4mux");
+        g_clear_object (&queue[RECORD_VIDEO]);
+        g_clear_object (&queue[RECORD_AUDIO]);
+        g_clear_object (&parser[RECORD_VIDEO]);
+        g_clear_object (&parser[RECORD_AUDIO]);
+        g_clear_object (&splitmux);
+        g_clear_object (&muxer);
+        g_clear_object (&sink);
+        return NULL;
+    }
+
+    if (config->format == RECORD_FORMAT_MP4) {
+        /* Self-contained moof fragments, no moov rewrite at the end: survives a crash */
+        g_object_set (muxer, "fragment-duration", RECORD_MP4_FRAGMENT_MS, "streamable", TRUE, NULL);
+    }
+    add_probe (sink, "sink", GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+               (GstPadProbeCallback) filesink_probe_cb, recorder);
+    g_object_set (splitmux, "muxer", muxer, "sink", sink, "location", config->location,
+                  "max-size-time", config->max_size_time, "max-size-bytes", config->max_size_bytes,
+                  /* Only valid for time based rotation: split exactly on time instead of on the next GOP */
+                  "send-keyframe-requests", config->max_size_time > 0 && config->max_size_bytes == 0, NULL);
+
+    bin = gst_bin_new (RECORD_BIN);
+    /* Forward the final EOS of splitmuxsink, the pipeline itself never goes EOS */
+    g_object_set (bin, "message-forward", TRUE, NULL);
+    gst_bin_add_many (GST_BIN (bin), queue[RECORD_VIDEO], parser[RECORD_VIDEO],
+                      queue[RECORD_AUDIO], parser[RECORD_AUDIO], splitmux, NULL);
+    if (!gst_element_link (queue[RECORD_VIDEO], parser[RECORD_VIDEO])
+        || !gst_element_link_pads (parser[RECORD_VIDEO], "src", splitmux, "video")
+        || !gst_element_link (queue[RECORD_AUDIO], parser[RECORD_AUDIO])
+        || !gst_element_link_pads (parser[RECORD_AUDIO], "src", splitmux, "audio_%u")) {
+        GST_ERROR ("Could not link the recording branch");
+        gst_object_unref (bin);
+        return NULL;
+    }
+    add_probe (queue[RECORD_VIDEO], "src", GST_PAD_PROBE_TYPE_BUFFER,
+               (GstPadProbeCallback) video_resync_probe_cb, recorder);
+
+    pad = gst_element_get_static_pad (queue[RECORD_VIDEO], "sink");
+    gst_element_add_pad (bin, gst_ghost_pad_new ("video_sink", pad));
+    gst_object_unref (pad);
+    pad = gst_element_get_static_pad (queue[RECORD_AUDIO], "sink");
+    gst_element_add_pad (bin, gst_ghost_pad_new ("audio_sink", pad));
+    gst_object_unref (pad);
+    return bin;
+}
+
+/* Unlink and drop the branch. Call with lock held, never from the branch's streaming threads */
+static void teardown_branch (Recorder * recorder)
+{
+    GstElement *bin;
+
+    if (!recorder->bin)
+        return;
+
+    for (int i = 0; i < RECORD_STREAM_MAX; ++i) {
+        if (recorder->tee_pad[i]) {
+            gst_pad_unlink (recorder->tee_pad[i], recorder->sink_pad[i]);
+            gst_element_release_request_pad (recorder->tee[i], recorder->tee_pad[i]);
+            gst_object_unref (recorder->tee_pad[i]);
+            recorder->tee_pad[i] = NULL;
+        }
+        gst_object_unref (recorder->sink_pad[i]);
+        recorder->sink_pad[i] = NULL;
+    }
+    gst_bin_remove (GST_BIN (recorder->pipeline), recorder->bin);
+    gst_element_set_state (recorder->bin, GST_STATE_NULL);
+    bin = recorder->bin;
+    g_atomic_pointer_set (&recorder->bin, NULL);
+    gst_object_unref (bin);
+    g_atomic_int_set (&recorder->state, RECORD_IDLE);
+    GST_DEBUG ("Recording branch removed");
+}
+
+/*
+ * Public methods
+ */
+
+Recorder * recorder_new (GstElement * pipeline)
+{
+    Recorder *recorder;
+    GstBus *bus;
+
+    GST_DEBUG_CATEGORY_INIT (debug_category, TAG, 0, "DVBT2-SENDER recording");
+
+    recorder = g_new0 (Recorder, 1);
+    recorder->pipeline = gst_object_ref (pipeline);
+    recorder->tee[RECORD_VIDEO] = gst_bin_get_by_name (GST_BIN (pipeline), VIDEO_ENC_TEE);
+    recorder->tee[RECORD_AUDIO] = gst_bin_get_by_name (GST_BIN (pipeline), AUDIO_ENC_TEE);
+    recorder->encoder = gst_bin_get_by_name (GST_BIN (pipeline), VIDEO_ENCODER);
+    g_mutex_init (&recorder->lock);
+    g_mutex_init (&recorder->stats_lock);
+    if (!recorder->tee[RECORD_VIDEO] || !recorder->tee[RECORD_AUDIO] || !recorder->encoder) {
+        GST_ERROR ("Pipeline has no %s/%s/%s, recording disabled", VIDEO_ENC_TEE, AUDIO_ENC_TEE, VIDEO_ENCODER);
+        recorder_free (recorder);
+        return NULL;
+    }
+
+    bus = gst_element_get_bus (pipeline);
+    gst_bus_enable_sync_message_emission (bus);
+    recorder->sync_error_id = g_signal_connect (G_OBJECT (bus), "sync-message::error", (GCallback) sync_error_cb, recorder);
+    gst_object_unref (bus);
+    return recorder;
+}
+
+void recorder_free (Recorder * recorder)
+{
+    if (!recorder)
+        return;
+
+    if (recorder->sync_error_id) {
+        GstBus *bus = gst_element_get_bus (recorder->pipeline);
+        g_signal_handler_disconnect (bus, recorder->sync_error_id);
+        gst_bus_disable_sync_message_emission (bus);
+        gst_object_unref (bus);
+    }
+    g_mutex_lock (&recorder->lock);
+    teardown_branch (recorder);
+    g_mutex_unlock (&recorder->lock);
+
+    g_clear_object (&recorder->tee[RECORD_VIDEO]);
+    g_clear_object (&recorder->tee[RECORD_AUDIO]);
+    g_clear_object (&recorder->encoder);
+    gst_object_unref (recorder->pipeline);
+    g_mutex_clear (&recorder->lock);
+    g_mutex_clear (&recorder->stats_lock);
+    g_free (recorder);
+}
+
+gboolean recorder_start (Recorder * recorder, const RecordConfig * config)
+{
+    GstPadProbeCallback tee_probe[RECORD_STREAM_MAX] = {
+            (GstPadProbeCallback) video_tee_probe_cb,
+            (GstPadProbeCallback) audio_tee_probe_cb,
+    };
+    GstElement *bin;
+
+    g_mutex_lock (&recorder->lock);
+    if (recorder->bin) {
+        GST_WARNING ("Recording already running");
+        g_mutex_unlock (&recorder->lock);
+        return FALSE;
+    }
+    if (!(bin = make_branch (recorder, config))) {
+        g_mutex_unlock (&recorder->lock);
+        return FALSE;
+    }
+
+    g_mutex_lock (&recorder->stats_lock);
+    memset (&recorder->stats, 0, sizeof (RecordStats));
+    g_mutex_unlock (&recorder->stats_lock);
+    g_atomic_int_set (&recorder->resync, 0);
+    g_atomic_int_set (&recorder->detaching[RECORD_VIDEO], 0);
+    g_atomic_int_set (&recorder->detaching[RECORD_AUDIO], 0);
+    g_atomic_int_set (&recorder->state, RECORD_WAITING_KEY);
+
+    g_atomic_pointer_set (&recorder->bin, gst_object_ref (bin));
+    gst_bin_add (GST_BIN (recorder->pipeline), bin);
+    recorder->sink_pad[RECORD_VIDEO] = gst_element_get_static_pad (bin, "video_sink");
+    recorder->sink_pad[RECORD_AUDIO] = gst_element_get_static_pad (bin, "audio_sink");
+    gst_element_sync_state_with_parent (bin);
+
+    /* Probes go on before linking, so nothing reaches the branch ahead of the first keyframe */
+    for (int i = 0; i < RECORD_STREAM_MAX; ++i) {
+        recorder->tee_pad[i] = gst_element_request_pad_simple (recorder->tee[i], "src_%u");
+        gst_pad_add_probe (recorder->tee_pad[i], GST_PAD_PROBE_TYPE_BUFFER, tee_probe[i], recorder, NULL);
+        if (gst_pad_link (recorder->tee_pad[i], recorder->sink_pad[i]) != GST_PAD_LINK_OK) {
+            GST_ERROR ("Could not link the recording branch to %s", GST_OBJECT_NAME (recorder->tee[i]));
+            teardown_branch (recorder);
+            g_mutex_unlock (&recorder->lock);
+            return FALSE;
+        }
+    }
+    request_keyframe (recorder);
+    GST_DEBUG ("Recording to %s", config->location);
+    g_mutex_unlock (&recorder->lock);
+    return TRUE;
+}
+
+void recorder_stop (Recorder * recorder)
+{
+    gint state;
+
+    g_mutex_lock (&recorder->lock);
+    /* The video thread may move WAITING_KEY to RECORDING at any time: retry until one CAS wins */
+    do {
+        if (g_atomic_int_compare_and_exchange (&recorder->state, RECORD_RECORDING, RECORD_STOPPING)) {
+            GST_DEBUG ("Stopping recording at next keyframe");
+            request_keyframe (recorder);
+            break;
+        }
+        if (g_atomic_int_compare_and_exchange (&recorder->state, RECORD_WAITING_KEY, RECORD_IDLE)) {
+            /* Nothing reached the muxer yet and the tee probes now drop everything: nothing to finalize */
+            teardown_branch (recorder);
+            break;
+        }
+        state = g_atomic_int_get (&recorder->state);
+    } while (state == RECORD_RECORDING || state == RECORD_WAITING_KEY);
+    g_mutex_unlock (&recorder->lock);
+}
+
+gboolean recorder_handle_message (Recorder * recorder, GstMessage * msg)
+{
+    GstObject *src = GST_MESSAGE_SRC (msg);
+    gboolean handled = FALSE;
+
+    g_mutex_lock (&recorder->lock);
+    switch (GST_MESSAGE_TYPE (msg)) {
+        case GST_MESSAGE_ELEMENT: {
+            const GstStructure *s = gst_message_get_structure (msg);
+            if (recorder->bin && src == GST_OBJECT (recorder->bin)) {
+                GstMessage *forwarded = NULL;
+                gst_structure_get (s, "message", GST_TYPE_MESSAGE, &forwarded, NULL);
+                if (forwarded && GST_MESSAGE_TYPE (forwarded) == GST_MESSAGE_EOS) {
+                    GST_DEBUG ("Last recording segment closed");
+                    teardown_branch (recorder);
+                }
+                if (forwarded)
+                    gst_message_unref (forwarded);
+                handled = TRUE;
+            } else if (gst_structure_has_name (s, "splitmuxsink-fragment-closed")) {
+                GST_DEBUG ("Recording segment closed: %s", gst_structure_get_string (s, "location"));
+                g_mutex_lock (&recorder->stats_lock);
+                recorder->stats.segments++;
+                g_mutex_unlock (&recorder->stats_lock);
+                handled = TRUE;
+            }
+            break;
+        }
+        case GST_MESSAGE_ERROR:
+            if (in_branch (src, recorder->bin)) {
+                GError *err;
+                gst_message_parse_error (msg, &err, NULL);
+                GST_ERROR ("Recording failed in %s: %s, live stream continues", GST_OBJECT_NAME (src), err->message);
+                g_clear_error (&err);
+                teardown_branch (recorder);
+                handled = TRUE;
+            } else if (!gst_object_has_as_ancestor (src, GST_OBJECT (recorder->pipeline))) {
+                /* Late error of a branch already removed (one failure often posts several): it must not
+                 * touch a branch started since */
+                GST_DEBUG ("Ignoring error of a removed recording branch from %s", GST_OBJECT_NAME (src));
+                handled = TRUE;
+            }
+            break;
+        default:
+            break;
+    }
+    g_mutex_unlock (&recorder->lock);
+    return handled;
+}
+
+RecordState recorder_get_state (Recorder * recorder)
+{
+    return (RecordState) g_atomic_int_get (&recorder->state);
+}
+
+void recorder_get_stats (Recorder * recorder, RecordStats * stats)
+{
+    g_mutex_lock (&recorder->stats_lock);
+    *stats = recorder->stats;
+    g_mutex_unlock (&recorder->stats_lock);
+}
@@ -0,0 +1,103 @@
+#ifndef NAMIDTVBT2EXAMPLE_DVBT2_RECORD_H
+#define NAMIDTVBT2EXAMPLE_DVBT2_RECORD_H
+
+#include <gst/gst.h>
+
+/**
+ * Local recording of what is broadcast.
+ * The branch hangs off VIDEO_ENC_TEE / AUDIO_ENC_TEE, so it records the H.264 and AAC already
+ * encoded for the UDP clients:
+ *
+ *   v_enc_tee. ! queue (leaky) ! h264parse ! splitmuxsink (fragmented mp4mux or mpegtsmux ! filesink)
+ *   a_enc_tee. ! queue (leaky) ! aacparse  ! splitmuxsink.audio_0
+ *
+ * Threads: the leaky queues' streaming threads run the parsers and feed splitmuxsink. splitmuxsink
+ * puts its own (non-leaky) queue in front of the muxer for each input, sized to hold about one GOP
+ * so it can cut on keyframes, and the muxer and filesink run on those internal queue threads.
+ *
+ * The leaky queues are the handoff: when storage stalls, splitmuxsink's queues fill up and block its
+ * inputs, then the leaky queues fill for queue_time and drop their oldest data instead of blocking
+ * the tees. Up to queue_time plus about one GOP is buffered before anything is dropped. After a drop
+ * the video is held back until the next keyframe so every segment stays decodable.
+ *
+ * Errors inside the branch (disk full, ...) only tear the branch down, the live path keeps running.
+ *
+ * Recording starts and stops on a keyframe (one is requested from VIDEO_ENCODER), segments rotate
+ * by time and/or size at keyframes (splitmuxsink).
+ *
+ * Thread safety: recorder_start/recorder_stop from any thread, recorder_handle_message from the
+ * thread dispatching the pipeline bus. Shared by the Android library and the host target: no JNI here.
+ */
+
+typedef enum _RecordFormat {
+    RECORD_FORMAT_MP4,          /* Fragmented MP4, readable up to the last fragment after a crash */
+    RECORD_FORMAT_TS,           /* MPEG-TS */
+} RecordFormat;
+
+typedef enum _RecordState {
+    RECORD_IDLE,
+    RECORD_WAITING_KEY,         /* Branch linked, dropping until the first keyframe */
+    RECORD_RECORDING,
+    RECORD_STOPPING,            /* Stop requested, recording until the next keyframe */
+    RECORD_DRAINING,            /* Tee pads being unlinked, then EOS into the branch: waiting for the last segment */
+    RECORD_FAILED,              /* Branch posted an error, waiting for the bus thread to remove it */
+} RecordState;
+
+typedef struct _RecordConfig {
+    const gchar *location;      /* Segment file pattern with one %d, e.g. "/sdcard/rec/dvbt2_%05d.mp4" */
+    RecordFormat format;
+    guint64 max_size_time;      /* Rotate after this duration (ns), 0 = no limit */
+    guint64 max_size_bytes;     /* Rotate after this size, 0 = no limit */
+    guint64 queue_time;         /* Leaky handoff queue bound (ns), 0 = RECORD_DEFAULT_QUEUE_TIME. Excludes
+                                 * splitmuxsink's internal queues */
+} RecordConfig;
+
+#define RECORD_DEFAULT_QUEUE_TIME (2 * GST_SECOND)
+/* Fragment duration of the MP4 muxer, in ms: bounds what is lost on a crash */
+#define RECORD_MP4_FRAGMENT_MS 1000
+
+/* Counters since the last recorder_start */
+typedef struct _RecordStats {
+    guint64 bytes;              /* Bytes handed to the filesink */
+    guint segments;             /* Segments closed */
+    guint overruns;             /* Handoff queue overflows (data dropped) */
+} RecordStats;
+
+typedef struct _Recorder {
+    GstElement *pipeline;
+    GstElement *tee[2];         /* VIDEO_ENC_TEE, AUDIO_ENC_TEE */
+    GstElement *encoder;        /* VIDEO_ENCODER, for keyframe requests */
+    GstElement *bin;            /* Recording branch, NULL when idle. Set atomically, compared by the sync error handler */
+    GstPad *tee_pad[2];         /* Request pads feeding the branch */
+    GstPad *sink_pad[2];        /* Ghost pads of the branch */
+    GMutex lock;                /* Branch lifecycle. Never taken from the branch's own streaming threads */
+    gint state;                 /* RecordState, read from the streaming threads */
+    gint resync;                /* Video dropped by the handoff queue, wait for a keyframe */
+    gint detaching[2];          /* Draining: IDLE probe installed on tee_pad[i] to unlink it */
+    gulong sync_error_id;       /* "sync-message::error" handler on the pipeline bus */
+    GMutex stats_lock;
+    RecordStats stats;
+} Recorder;
+
+/* Returns NULL if pipeline has no VIDEO_ENC_TEE/AUDIO_ENC_TEE/VIDEO_ENCODER */
+Recorder * recorder_new (GstElement * pipeline);
+
+/* Remove a running branch without finalizing it (fragmented MP4/TS stay readable) and free.
+ * The pipeline must already be in NULL state: the tee probes dereference recorder */
+void recorder_free (Recorder * recorder);
+
+/* Link a new recording branch into the playing pipeline. FALSE if busy or the branch cannot be built */
+gboolean recorder_start (Recorder * recorder, const RecordConfig * config);
+
+/* Stop at the next keyframe. The branch is removed once its last segment is closed */
+void recorder_stop (Recorder * recorder);
+
+/* Feed bus messages here. Returns TRUE if the message belonged to the recording branch
+ * (errors included: they must not stop the pipeline) */
+gboolean recorder_handle_message (Recorder * recorder, GstMessage * msg);
+
+RecordState recorder_get_state (Recorder * recorder);
+
+void recorder_get_stats (Recorder * recorder, RecordStats * stats);
+
+#endif //NAMIDTVBT2EXAMPLE_DVBT2_RECORD_H
@@ -84,6 +84,16 @@ static void error_cb (GstBus * bus, GstMessage * msg, CustomData * data)
     gchar *debug_info;
     gchar *message_string;
 
+    /* Recording branch errors only stop the recording. Late errors of an already removed branch stop nothing */
+    if (data->recorder) {
+        RecordState state = recorder_get_state (data->recorder);
+        if (recorder_handle_message (data->recorder, msg)) {
+            if (state != RECORD_IDLE && recorder_get_state (data->recorder) == RECORD_IDLE)
+                set_ui_message ("Recording stopped on error, broadcast continues", data);
+            return;
+        }
+    }
+
     gst_message_parse_error (msg, &err, &debug_info);
     message_string = g_strdup_printf ("Error received from element %s: %s", GST_OBJECT_NAME (msg->src), err->message);
     g_clear_error (&err);
@@ -94,6 +104,13 @@ static void error_cb (GstBus * bus, GstMessage * msg, CustomData * data)
     set_ui_state(GST_STATE_NULL, data);
 }
 
+/* Recording segment and end-of-recording notifications */
+static void element_cb (GstBus * bus, GstMessage * msg, CustomData * data)
+{
+    if (data->recorder)
+        recorder_handle_message (data->recorder, msg);
+}
+
 /* Notify UI about pipeline state changes */
 static void state_changed_cb (GstBus * bus, GstMessage * msg, CustomData * data)
 {
@@ -201,6 +218,10 @@ static void * app_function (void *userdata)
     data->element[E_CE_VSYNC_1] = gst_bin_get_by_name(GST_BIN(data->pipeline), VSYNC_1);
     data->vsink_state[0] = false;
     data->vsink_state[0] = false;
+    data->abs_capture = abs_capture_probe_new (data->pipeline, ABS_CAPTURE_TIME_EXT_ID);
+    if (data->abs_capture)
+        abs_capture_probe_set_active (data->abs_capture, data->abs_capture_enabled);
+    data->recorder = recorder_new (data->pipeline);
 
     /* Set the pipeline to READY, so it can already accept a window handle, if we have one */
     gst_element_set_state (data->pipeline, GST_STATE_READY);
@@ -224,6 +245,7 @@ static void * app_function (void *userdata)
     g_source_unref (bus_source);
     g_signal_connect (G_OBJECT (bus), "message::error", (GCallback) error_cb, data);
     g_signal_connect (G_OBJECT (bus), "message::state-changed", (GCallback) state_changed_cb, data);
+    g_signal_connect (G_OBJECT (bus), "message::element", (GCallback) element_cb, data);
     gst_object_unref (bus);
 
     /* Create a GLib Main Loop and set it to run */
@@ -239,12 +261,16 @@ static void * app_function (void *userdata)
     g_main_context_pop_thread_default (data->context);
     g_main_context_unref (data->context);
     gst_element_set_state (data->pipeline, GST_STATE_NULL);
+    recorder_free (data->recorder);
+    data->recorder = NULL;
     gst_object_unref (data->surface[SURFACE_DW].video_sink);
     gst_object_unref (data->surface[SURFACE_FMMW].video_sink);
     for (int ce_item = 0; ce_item < E_CE_MAX; ++ce_item) {
         gst_object_unref(data->element[ce_item]);
     }
     gst_object_unref (data->pipeline);
+    abs_capture_probe_free (data->abs_capture);
+    data->abs_capture = NULL;
     return NULL;
 }
 
@@ -275,6 +301,9 @@ static void gst_native_init (JNIEnv * env, jobject thiz)
     data->vsink_state[0] = FALSE;
     data->vsink_state[1] = FALSE;
     data->testmode = FALSE;
+    data->abs_capture = NULL;
+    data->abs_capture_enabled = FALSE;
+    data->recorder = NULL;
     GST_DEBUG ("Init/Preset few data");
     pthread_create (&gst_app_thread, NULL, &app_function, data);
 }
@@ -483,6 +512,56 @@ static void gst_native_stop_videotestsrc (JNIEnv * env, jobject thiz)
     GST_DEBUG ("Restart <gst_app_thread>");
     pthread_create (&gst_app_thread, NULL, &app_function, data);
 }
+static void gst_native_set_capture_timestamp (JNIEnv * env, jobject thiz, jboolean enable)
+{
+    CustomData *data = GET_CUSTOM_DATA (env, thiz, custom_data_field_id);
+    if (!data)
+        return;
+
+    // Kept across pipeline restarts (test mode), applied again in app_function
+    data->abs_capture_enabled = enable ? TRUE : FALSE;
+    if (data->abs_capture)
+        abs_capture_probe_set_active (data->abs_capture, data->abs_capture_enabled);
+    GST_DEBUG ("Capture timestamp extension: %d", data->abs_capture_enabled);
+}
+
+/**
+ *
+ * @param location segment file pattern with one %d, e.g. "/sdcard/Movies/dvbt2_%05d.mp4"
+ * @param format 0: fragmented MP4, 1: MPEG-TS
+ * @param max_seconds rotate segments after this many seconds, 0 = no limit
+ * @param max_megabytes rotate segments after this many MB, 0 = no limit
+ */
+static void gst_native_start_record (JNIEnv * env, jobject thiz, jstring location, jint format, jint max_seconds, jint max_megabytes)
+{
+    CustomData *data = GET_CUSTOM_DATA (env, thiz, custom_data_field_id);
+    if (!data || !data->recorder)
+        return;
+
+    const char *_location = (*env)->GetStringUTFChars(env, location, NULL);
+    RecordConfig config = {
+            .location = _location,
+            .format = format == RECORD_FORMAT_TS ? RECORD_FORMAT_TS : RECORD_FORMAT_MP4,
+            .max_size_time = (guint64) MAX (max_seconds, 0) * GST_SECOND,
+            .max_size_bytes = (guint64) MAX (max_megabytes, 0) * 1024 * 1024,
+            .queue_time = RECORD_DEFAULT_QUEUE_TIME,
+    };
+    if (!recorder_start (data->recorder, &config))
+        set_ui_message ("Unable to start recording", data);
+    GST_DEBUG ("Start Record: %s", _location);
+    (*env)->ReleaseStringUTFChars(env, location, _location);
+}
+
+static void gst_native_stop_record (JNIEnv * env, jobject thiz)
+{
+    CustomData *data = GET_CUSTOM_DATA (env, thiz, custom_data_field_id);
+    if (!data || !data->recorder)
+        return;
+
+    // Finishes at the next keyframe, the branch is removed from the main loop
+    recorder_stop (data->recorder);
+}
+
 /*
  * List of implemented native methods
  * */
@@ -501,6 +580,9 @@ static JNINativeMethod native_methods[] = {
         {"nativeStopBroadcast", "(Ljava/lang/String;I)V", (void *) gst_native_stop_broadcast},
         {"nativeStartVideoTest", "()V", (void *) gst_native_start_videotestsrc},
         {"nativeStopVideoTest", "()V", (void *) gst_native_stop_videotestsrc},
+        {"nativeSetCaptureTimestamp", "(Z)V", (void *) gst_native_set_capture_timestamp},
+        {"nativeStartRecord", "(Ljava/lang/String;III)V", (void *) gst_native_start_record},
+        {"nativeStopRecord", "()V", (void *) gst_native_stop_record},
 };
 
 /* Library initializer */
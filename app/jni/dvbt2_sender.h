@@ -16,6 +16,9 @@
 #include <gst/video/video.h>
 #include <pthread.h>
 #include <unistd.h>
+#include "dvbt2_pipeline.h"
+#include "dvbt2_abs_capture.h"
+#include "dvbt2_record.h"
 
 GST_DEBUG_CATEGORY_STATIC (debug_category);
 
@@ -35,49 +38,6 @@ GST_DEBUG_CATEGORY_STATIC (debug_category);
 #endif
 
 #define TAG "dvbt2_sender"
-/**
- * Have 2 tee line with
- * Queue name for each tee is "tee1", "tee2"
- * Output for each sync is "vsink1", "vsink2"
- */
-#define VSYNC_0 "vsink0"
-#define VSYNC_1 "vsink1"
-#define VALVE   "valve"
-#define UDP_VIDEO_SINK "v_udp_sink"
-#define UDP_AUDIO_SINK "a_udp_sink"
-
-#define PIPELINE_NAMI_VIDEOTEST "gltestsrc ! glupload ! " \
-    /* Raise source framerate cap to 30fps (if camera supports it). */ \
-    "tee name=t " \
-    /* FMMD preview branch: same idea */ \
-    "t. ! queue name=t0 ! " \
-    "glcolorconvert ! glimagesink name="VSYNC_0" " \
-    /* DW preview branch: small, leaky queue keeps UI responsive */ \
-    "t. ! queue name=t1 ! " \
-    "glcolorconvert ! glimagesink name="VSYNC_1" " \
-    /* Multi up sink for the registed ip address */ \
-    "t. ! queue name=t2 ! " \
-    "glcolorconvert ! gldownload ! video/x-raw,format=I420 ! x264enc tune=zerolatency ! rtph264pay ! " \
-    "multiudpsink name="UDP_VIDEO_SINK" sync=true async=false " \
-    "openslessrc ! audioconvert ! voaacenc ! rtpmp4gpay ! "        \
-    "multiudpsink name="UDP_AUDIO_SINK" sync=true async=false "        \
-
-#define PIPELINE_NAMI_DVBT2 "ahcsrc device=0 ! video/x-raw,width=1920,height=1080,framerate=30/1 ! " \
-    /* Raise source framerate cap to 30fps (if camera supports it). */ \
-    "tee name=t " \
-    /* FMMD preview branch: same idea */ \
-    "t. ! queue name=t0 ! " \
-    "videoconvert ! glimagesink name="VSYNC_0" sync=false async=false " \
-    /* DW preview branch: small, leaky queue keeps UI responsive */ \
-    "t. ! queue name=t1 ! " \
-    "videoconvert ! glimagesink name="VSYNC_1" sync=false async=false " \
-    /* Multi up sink for the registed ip address */ \
-    "t. ! queue name=t2 ! " \
-    "videoconvert ! x264enc tune=zerolatency ! rtph264pay ! " \
-    "multiudpsink name="UDP_VIDEO_SINK" sync=true async=false " \
-    "openslessrc ! audioconvert ! voaacenc ! rtpmp4gpay ! " \
-    "multiudpsink name="UDP_AUDIO_SINK" sync=true async=false " \
-
 // GSurface
 #define SURFACE_FMMW 0
 #define SURFACE_DW   1
@@ -112,6 +72,9 @@ typedef struct _CustomData
     GstElement *element[E_CE_MAX];
     gboolean vsink_state[2];
     gboolean testmode;
+    AbsCaptureProbe *abs_capture; /* Latency probe on the video RTP chain, NULL if the pipeline lacks it */
+    gboolean abs_capture_enabled; /* Write the capture timestamp RTP header extension */
+    Recorder *recorder;           /* Local recording branch, NULL if the pipeline lacks the encoder tees */
 } CustomData;
 
 /* Custom data pointer which will be save from application zone */
@@ -182,6 +145,15 @@ static void gst_native_start_videotestsrc (JNIEnv * env, jobject thiz);
 
 static void gst_native_stop_videotestsrc (JNIEnv * env, jobject thiz);
 
+/* Enable/disable the absolute capture time RTP header extension on the video stream */
+static void gst_native_set_capture_timestamp (JNIEnv * env, jobject thiz, jboolean enable);
+
+/* Record the broadcast streams into segmented files */
+static void gst_native_start_record (JNIEnv * env, jobject thiz, jstring location, jint format, jint max_seconds, jint max_megabytes);
+
+/* Stop recording at the next keyframe */
+static void gst_native_stop_record (JNIEnv * env, jobject thiz);
+
 typedef enum _Method
 {
     METHOD_GST_MESSAGE,     // This for method send back the message to the application (maybe unused or for debug)
@@ -0,0 +1,471 @@
+/*
+ * Benchmark harness for the headless sender pipeline.
+ *
+ * Sweeps resolution x framerate x speed-preset x bitrate x receiver count. For every combination the
+ * pipeline is built from scratch, N loopback UDP receivers are registered as clients, and after a
+ * warm-up period one JSON object per line is written with:
+ *   fps               encoded video frames handed to the video multiudpsink per second
+ *   cpu_ms_per_frame  sender CPU time (user + system) per encoded frame: process CPU minus the receivers
+ *   cpu_percent       sender CPU time over wall time (100 = one core)
+ *   rx_cpu_percent    CPU time of all loopback receiver threads together over wall time
+ *   tx_*_pps          RTP packets per second handed to the multiudpsinks
+ *   rx_pps            RTP packets per second received by all loopback receivers together
+ *   rx_loss_ratio     1 - received / (sent * receivers)
+ *   latency_*_ms      capture (buffer PTS) -> video multiudpsink, per frame
+ *   jitter_*_ms       |frame interval - 1/framerate| at the video multiudpsink, per frame
+ *   record_*          with --records=mp4,ts the recording branch (dvbt2_record.h) runs during the
+ *                     measurement: write throughput, closed segments and handoff queue overruns
+ *
+ * Example:
+ *   ./build/dvbt2_bench --resolutions=1280x720,1920x1080 --framerates=30,60 \
+ *       --presets=ultrafast,veryfast --bitrates=2048,4096 --receivers=1,4,16 > bench.jsonl
+ *   ./build/dvbt2_bench --resolutions=1920x1080 --receivers=4 --records=off,mp4,ts --record-dir=/mnt/sd
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <glib/gstdio.h>
+#include "dvbt2_host.h"
+
+#define RECEIVER_POLL_MS 100
+/* Recording dimension of the sweep: RECORD_OFF or a RecordFormat */
+#define RECORD_OFF -1
+/* How long to wait for the recording to close its last segment */
+#define RECORD_STOP_TIMEOUT 10
+
+/* One loopback client: video on port, audio on port+1 (see host_sender_add_client) */
+typedef struct _LoopbackReceiver {
+    pthread_t thread;
+    clockid_t clock;            /* CPU-time clock of thread */
+    int fd[2];
+    gint port;
+    gint stop;
+    gint packets;
+} LoopbackReceiver;
+
+/* Sweep parameters, filled from the command line */
+static gchar *opt_resolutions = "640x480,1280x720,1920x1080";
+static gchar *opt_framerates = "30";
+static gchar *opt_presets = "ultrafast";
+static gchar *opt_bitrates = "2048";
+static gchar *opt_receivers = "1,4";
+static gint opt_key_int_max = 0;
+static gint opt_duration = 10;
+static gint opt_warmup = 2;
+static gint opt_base_port = 5000;
+static gchar *opt_output = NULL;
+static gchar *opt_records = "off";
+static gchar *opt_record_dir = NULL;
+static gint opt_segment_time = 10;
+static gint opt_segment_size = 0;
+static gboolean opt_keep_recordings = FALSE;
+
+static GOptionEntry entries[] = {
+        {"resolutions", 'r', 0, G_OPTION_ARG_STRING, &opt_resolutions, "Comma separated WxH list", "LIST"},
+        {"framerates", 'f', 0, G_OPTION_ARG_STRING, &opt_framerates, "Comma separated framerate list", "LIST"},
+        {"presets", 'p', 0, G_OPTION_ARG_STRING, &opt_presets, "Comma separated x264enc speed-preset list", "LIST"},
+        {"bitrates", 'b', 0, G_OPTION_ARG_STRING, &opt_bitrates, "Comma separated x264enc bitrate list (kbit/s)", "LIST"},
+        {"receivers", 'n', 0, G_OPTION_ARG_STRING, &opt_receivers, "Comma separated loopback receiver count list", "LIST"},
+        {"key-int-max", 'k', 0, G_OPTION_ARG_INT, &opt_key_int_max, "x264enc key-int-max (0 = encoder default)", "N"},
+        {"duration", 'd', 0, G_OPTION_ARG_INT, &opt_duration, "Measured seconds per combination", "S"},
+        {"warmup", 'w', 0, G_OPTION_ARG_INT, &opt_warmup, "Unmeasured seconds before each measurement", "S"},
+        {"base-port", 0, 0, G_OPTION_ARG_INT, &opt_base_port, "First loopback port, receiver i uses base+2i and base+2i+1", "PORT"},
+        {"output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output, "Write JSON lines here instead of stdout", "FILE"},
+        {"records", 0, 0, G_OPTION_ARG_STRING, &opt_records, "Comma separated recording list: off, mp4, ts", "LIST"},
+        {"record-dir", 0, 0, G_OPTION_ARG_FILENAME, &opt_record_dir, "Directory for recorded segments (default: tmp)", "DIR"},
+        {"segment-time", 0, 0, G_OPTION_ARG_INT, &opt_segment_time, "Rotate segments after S seconds (0 = no limit)", "S"},
+        {"segment-size", 0, 0, G_OPTION_ARG_INT, &opt_segment_size, "Rotate segments after MB megabytes (0 = no limit)", "MB"},
+        {"keep-recordings", 0, 0, G_OPTION_ARG_NONE, &opt_keep_recordings, "Do not delete recorded segments", NULL},
+        {NULL}
+};
+
+/*
+ * Loopback receivers
+ */
+
+static void * receiver_function (void *userdata)
+{
+    LoopbackReceiver *receiver = (LoopbackReceiver *) userdata;
+    struct pollfd pfd[2] = {
+            {receiver->fd[0], POLLIN, 0},
+            {receiver->fd[1], POLLIN, 0},
+    };
+    guint8 packet[65536];
+
+    while (!g_atomic_int_get (&receiver->stop)) {
+        if (poll (pfd, 2, RECEIVER_POLL_MS) <= 0)
+            continue;
+        for (int i = 0; i < 2; ++i) {
+            if (!(pfd[i].revents & POLLIN))
+                continue;
+            while (recv (pfd[i].fd, packet, sizeof (packet), MSG_DONTWAIT) >= 0) {
+                g_atomic_int_inc (&receiver->packets);
+            }
+        }
+    }
+    return NULL;
+}
+
+static gboolean receiver_start (LoopbackReceiver * receiver, gint port)
+{
+    receiver->port = port;
+    receiver->stop = 0;
+    receiver->packets = 0;
+    receiver->fd[0] = host_open_loopback_socket (port);
+    receiver->fd[1] = host_open_loopback_socket (port + 1);
+    if (receiver->fd[0] < 0 || receiver->fd[1] < 0) {
+        g_printerr ("Could not bind %s:%d/%d: %s\n", LOOPBACK_IP, port, port + 1, g_strerror (errno));
+        if (receiver->fd[0] >= 0)
+            close (receiver->fd[0]);
+        if (receiver->fd[1] >= 0)
+            close (receiver->fd[1]);
+        return FALSE;
+    }
+    pthread_create (&receiver->thread, NULL, &receiver_function, receiver);
+    pthread_getcpuclockid (receiver->thread, &receiver->clock);
+    return TRUE;
+}
+
+static void receiver_stop (LoopbackReceiver * receiver)
+{
+    g_atomic_int_set (&receiver->stop, 1);
+    pthread_join (receiver->thread, NULL);
+    close (receiver->fd[0]);
+    close (receiver->fd[1]);
+}
+
+static guint64 receivers_packets (LoopbackReceiver * receivers, gint count)
+{
+    guint64 total = 0;
+    for (int i = 0; i < count; ++i) {
+        total += (guint) g_atomic_int_get (&receivers[i].packets);
+    }
+    return total;
+}
+
+/* CPU time spent in the receiver threads, so it can be kept out of the sender's share */
+static gint64 receivers_cpu_time_us (LoopbackReceiver * receivers, gint count)
+{
+    gint64 total = 0;
+    for (int i = 0; i < count; ++i) {
+        struct timespec ts;
+        if (clock_gettime (receivers[i].clock, &ts) == 0)
+            total += (gint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+    }
+    return total;
+}
+
+/*
+ * Measurement
+ */
+
+static gint64 cpu_time_us (void)
+{
+    struct rusage usage;
+    getrusage (RUSAGE_SELF, &usage);
+    return (gint64) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC
+           + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static const gchar * record_name (gint record)
+{
+    return record == RECORD_OFF ? "off" : (record == RECORD_FORMAT_TS ? "ts" : "mp4");
+}
+
+/* Stop the recording and wait, watching the bus, until its last segment is closed */
+static gchar * stop_recording (HostData * data)
+{
+    gint64 end = g_get_monotonic_time () + (gint64) RECORD_STOP_TIMEOUT * G_USEC_PER_SEC;
+    gchar *error;
+
+    recorder_stop (data->recorder);
+    while (recorder_get_state (data->recorder) != RECORD_IDLE) {
+        if ((error = host_sender_pop_error (data)))
+            return error;
+        if (g_get_monotonic_time () >= end)
+            return g_strdup ("Recording did not finish in time");
+        g_usleep (RECEIVER_POLL_MS * 1000);
+    }
+    return NULL;
+}
+
+static void delete_recordings (const gchar * location)
+{
+    for (gint i = 0;; ++i) {
+        gchar *file = g_strdup_printf (location, i);
+        gboolean removed = g_unlink (file) == 0;
+        g_free (file);
+        if (!removed)
+            break;
+    }
+}
+
+static void write_result (FILE * out, const HostConfig * config, gint receivers, gint record, const gchar * error,
+                          gdouble seconds, const HostStats * stats, gint64 cpu_us, gint64 rx_cpu_us,
+                          guint64 rx_packets, const RecordStats * record_stats)
+{
+    gdouble fps = seconds > 0 ? stats->video_frames / seconds : 0;
+    guint64 tx_packets = stats->video_packets + stats->audio_packets;
+    guint64 rx_expected = tx_packets * receivers;
+    gchar *escaped = error ? g_strescape (error, NULL) : NULL;
+
+    host_sort_samples (stats->latency);
+    host_sort_samples (stats->jitter);
+    fprintf (out, "{\"width\":%d,\"height\":%d,\"framerate\":%d,\"speed_preset\":\"%s\",\"bitrate_kbps\":%d,"
+                  "\"key_int_max\":%d,\"receivers\":%d,\"duration_s\":%.3f,\"frames\":%" G_GUINT64_FORMAT ","
+                  "\"fps\":%.2f,\"cpu_ms_per_frame\":%.3f,\"cpu_percent\":%.1f,\"rx_cpu_percent\":%.1f,"
+                  "\"tx_video_pps\":%.1f,\"tx_audio_pps\":%.1f,\"rx_pps\":%.1f,\"rx_loss_ratio\":%.4f,"
+                  "\"latency_p50_ms\":%.2f,\"latency_p99_ms\":%.2f,",
+             config->width, config->height, config->framerate, config->speed_preset, config->bitrate,
+             config->key_int_max, receivers, seconds, stats->video_frames,
+             fps,
+             stats->video_frames ? cpu_us / 1000.0 / stats->video_frames : 0,
+             seconds > 0 ? cpu_us / 10000.0 / seconds : 0,
+             seconds > 0 ? rx_cpu_us / 10000.0 / seconds : 0,
+             seconds > 0 ? stats->video_packets / seconds : 0,
+             seconds > 0 ? stats->audio_packets / seconds : 0,
+             seconds > 0 ? rx_packets / seconds : 0,
+             rx_expected ? 1.0 - MIN (rx_packets, rx_expected) / (gdouble) rx_expected : 0,
+             host_percentile_ms (stats->latency, 0.50), host_percentile_ms (stats->latency, 0.99));
+    fprintf (out, "\"jitter_p50_ms\":%.2f,\"jitter_p99_ms\":%.2f,\"record\":\"%s\",\"record_mbps\":%.2f,"
+                  "\"record_segments\":%u,\"record_overruns\":%u,",
+             host_percentile_ms (stats->jitter, 0.50), host_percentile_ms (stats->jitter, 0.99), record_name (record),
+             seconds > 0 ? record_stats->bytes * 8 / 1e6 / seconds : 0,
+             record_stats->segments, record_stats->overruns);
+    if (escaped)
+        fprintf (out, "\"error\":\"%s\"}\n", escaped);
+    else
+        fprintf (out, "\"error\":null}\n");
+    fflush (out);
+    g_free (escaped);
+}
+
+/* Build, run and measure one combination. Returns FALSE if the pipeline failed */
+static gboolean bench_one (FILE * out, const HostConfig * config, gint receivers, gint record)
+{
+    LoopbackReceiver *receiver = g_new0 (LoopbackReceiver, receivers);
+    HostStats stats = {0};
+    RecordStats record_stats = {0};
+    gchar *location = NULL;
+    gboolean recording = FALSE;
+    GError *err = NULL;
+    gchar *error = NULL;
+    gint started = 0;
+    gint64 wall_start = 0, cpu_start = 0, rx_cpu_start = 0, wall_us = 0, cpu_us = 0, rx_cpu_us = 0;
+    guint64 rx_start = 0, rx_packets = 0;
+    HostData *data = host_sender_new (config, &err);
+
+    g_printerr ("%dx%d@%d preset=%s bitrate=%d receivers=%d record=%s\n", config->width, config->height,
+                config->framerate, config->speed_preset, config->bitrate, receivers, record_name (record));
+
+    if (!data) {
+        error = g_strdup_printf ("Unable to build pipeline: %s", err ? err->message : "unknown");
+        g_clear_error (&err);
+        goto done;
+    }
+
+    for (; started < receivers; ++started) {
+        gint port = opt_base_port + 2 * started;
+        if (!receiver_start (&receiver[started], port)) {
+            error = g_strdup_printf ("Could not bind loopback receiver on port %d", port);
+            goto done;
+        }
+        host_sender_add_client (data, LOOPBACK_IP, port);
+    }
+
+    if (!host_sender_play (data)) {
+        error = host_sender_pop_error (data);
+        if (!error)
+            error = g_strdup ("Unable to set the pipeline to the playing state");
+        goto done;
+    }
+
+    if ((error = host_sender_run_for (data, opt_warmup)))
+        goto done;
+
+    if (record != RECORD_OFF) {
+        RecordConfig record_config = {0};
+        location = g_build_filename (opt_record_dir ? opt_record_dir : g_get_tmp_dir (),
+                                     record == RECORD_FORMAT_TS ? "dvbt2_bench_%05d.ts" : "dvbt2_bench_%05d.mp4", NULL);
+        record_config.location = location;
+        record_config.format = record;
+        record_config.max_size_time = (guint64) opt_segment_time * GST_SECOND;
+        record_config.max_size_bytes = (guint64) opt_segment_size * 1024 * 1024;
+        if (!data->recorder || !recorder_start (data->recorder, &record_config)) {
+            error = g_strdup ("Unable to start recording");
+            goto done;
+        }
+        recording = TRUE;
+    }
+
+    host_sender_reset_stats (data);
+    rx_start = receivers_packets (receiver, started);
+    cpu_start = cpu_time_us ();
+    rx_cpu_start = receivers_cpu_time_us (receiver, started);
+    wall_start = g_get_monotonic_time ();
+
+    error = host_sender_run_for (data, opt_duration);
+
+    host_sender_take_stats (data, &stats);
+    cpu_us = cpu_time_us () - cpu_start;
+    rx_cpu_us = receivers_cpu_time_us (receiver, started) - rx_cpu_start;
+    cpu_us = MAX (cpu_us - rx_cpu_us, 0);
+    wall_us = g_get_monotonic_time () - wall_start;
+    rx_packets = receivers_packets (receiver, started) - rx_start;
+    if (recording)
+        recorder_get_stats (data->recorder, &record_stats);
+
+done:
+    if (recording && !error)
+        error = stop_recording (data);
+    if (!stats.latency)
+        stats.latency = g_array_new (FALSE, FALSE, sizeof (guint64));
+    if (!stats.jitter)
+        stats.jitter = g_array_new (FALSE, FALSE, sizeof (guint64));
+    write_result (out, config, receivers, record, error, wall_us / (gdouble) G_USEC_PER_SEC, &stats, cpu_us,
+                  rx_cpu_us, rx_packets, &record_stats);
+
+    host_sender_free (data);
+    for (int i = 0; i < started; ++i) {
+        receiver_stop (&receiver[i]);
+    }
+    g_free (receiver);
+    g_array_unref (stats.latency);
+    g_array_unref (stats.jitter);
+    if (location && !opt_keep_recordings)
+        delete_recordings (location);
+    g_free (location);
+    if (error) {
+        g_printerr ("  %s\n", error);
+        g_free (error);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Split a comma separated list of integers, returns NULL if any item is not a positive integer */
+static GArray * parse_int_list (const gchar * list)
+{
+    gchar **items = g_strsplit (list, ",", -1);
+    GArray *values = g_array_new (FALSE, FALSE, sizeof (gint));
+
+    for (gchar **item = items; *item; ++item) {
+        gint64 value;
+        if (!g_ascii_string_to_signed (g_strstrip (*item), 10, 1, G_MAXINT, &value, NULL)) {
+            g_array_unref (values);
+            values = NULL;
+            break;
+        }
+        gint v = (gint) value;
+        g_array_append_val (values, v);
+    }
+    g_strfreev (items);
+    return values;
+}
+
+/* Split a comma separated list of off/mp4/ts, returns NULL on an unknown item */
+static GArray * parse_record_list (const gchar * list)
+{
+    gchar **items = g_strsplit (list, ",", -1);
+    GArray *values = g_array_new (FALSE, FALSE, sizeof (gint));
+
+    for (gchar **item = items; *item; ++item) {
+        const gchar *name = g_strstrip (*item);
+        gint v;
+        if (g_str_equal (name, "off")) {
+            v = RECORD_OFF;
+        } else if (g_str_equal (name, "mp4")) {
+            v = RECORD_FORMAT_MP4;
+        } else if (g_str_equal (name, "ts")) {
+            v = RECORD_FORMAT_TS;
+        } else {
+            g_array_unref (values);
+            values = NULL;
+            break;
+        }
+        g_array_append_val (values, v);
+    }
+    g_strfreev (items);
+    return values;
+}
+
+int main (int argc, char *argv[])
+{
+    GOptionContext *context = g_option_context_new ("- benchmark the headless dvbt2 sender pipeline");
+    GError *err = NULL;
+    GArray *framerates, *bitrates, *receivers, *records;
+    gchar **resolutions, **presets;
+    FILE *out = stdout;
+    gboolean ok = TRUE;
+
+    g_option_context_add_main_entries (context, entries, NULL);
+    g_option_context_add_group (context, gst_init_get_option_group ());
+    if (!g_option_context_parse (context, &argc, &argv, &err)) {
+        g_printerr ("%s\n", err->message);
+        g_clear_error (&err);
+        g_option_context_free (context);
+        return 2;
+    }
+    g_option_context_free (context);
+
+    framerates = parse_int_list (opt_framerates);
+    bitrates = parse_int_list (opt_bitrates);
+    receivers = parse_int_list (opt_receivers);
+    if (!framerates || !bitrates || !receivers || opt_duration <= 0 || opt_warmup < 0) {
+        g_printerr ("Invalid framerates, bitrates, receivers, duration or warmup\n");
+        return 2;
+    }
+    if (!(records = parse_record_list (opt_records))) {
+        g_printerr ("Invalid records, expected off, mp4 or ts\n");
+        return 2;
+    }
+    resolutions = g_strsplit (opt_resolutions, ",", -1);
+    presets = g_strsplit (opt_presets, ",", -1);
+
+    if (opt_output && !(out = fopen (opt_output, "w"))) {
+        g_printerr ("Could not open %s: %s\n", opt_output, g_strerror (errno));
+        return 2;
+    }
+
+    for (gchar **resolution = resolutions; *resolution; ++resolution) {
+        HostConfig config = {0};
+        if (sscanf (*resolution, "%dx%d", &config.width, &config.height) != 2) {
+            g_printerr ("Invalid resolution %s\n", *resolution);
+            ok = FALSE;
+            continue;
+        }
+        config.key_int_max = opt_key_int_max;
+        for (guint f = 0; f < framerates->len; ++f) {
+            config.framerate = g_array_index (framerates, gint, f);
+            for (gchar **preset = presets; *preset; ++preset) {
+                config.speed_preset = *preset;
+                for (guint b = 0; b < bitrates->len; ++b) {
+                    config.bitrate = g_array_index (bitrates, gint, b);
+                    for (guint n = 0; n < receivers->len; ++n) {
+                        for (guint r = 0; r < records->len; ++r) {
+                            ok &= bench_one (out, &config, g_array_index (receivers, gint, n),
+                                             g_array_index (records, gint, r));
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (out != stdout)
+        fclose (out);
+    g_strfreev (resolutions);
+    g_strfreev (presets);
+    g_array_unref (framerates);
+    g_array_unref (bitrates);
+    g_array_unref (receivers);
+    g_array_unref (records);
+    return ok ? 0 : 1;
+}
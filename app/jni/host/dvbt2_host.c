@@ -0,0 +1,295 @@
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "dvbt2_host.h"
+
+#define TAG "dvbt2_host"
+#define LOOPBACK_RCVBUF (4 * 1024 * 1024)
+#define BUS_POLL_MS 100
+
+GST_DEBUG_CATEGORY_STATIC (debug_category);
+
+#define GST_CAT_DEFAULT debug_category
+
+/*
+ * Private methods
+ */
+
+/* Current running time of the pipeline, GST_CLOCK_TIME_NONE before it has a clock */
+static GstClockTime get_running_time (GstElement * element)
+{
+    GstClock *clock = gst_element_get_clock (element);
+    GstClockTime now;
+
+    if (!clock)
+        return GST_CLOCK_TIME_NONE;
+    now = gst_clock_get_time (clock) - gst_element_get_base_time (element);
+    gst_object_unref (clock);
+    return now;
+}
+
+/* Count one RTP packet of the video stream. All packets of a frame carry the frame PTS */
+static void account_video_buffer (HostData * data, GstBuffer * buffer, GstClockTime now)
+{
+    GstClockTime pts = GST_BUFFER_PTS (buffer);
+
+    data->stats.video_packets++;
+    if (!GST_CLOCK_TIME_IS_VALID (pts) || pts == data->last_pts)
+        return;
+
+    data->last_pts = pts;
+    data->stats.video_frames++;
+    if (GST_CLOCK_TIME_IS_VALID (now) && GST_CLOCK_TIME_IS_VALID (data->last_frame)) {
+        guint64 interval = now - data->last_frame;
+        guint64 jitter = interval > data->frame_duration ? interval - data->frame_duration : data->frame_duration - interval;
+        g_array_append_val (data->stats.jitter, jitter);
+    }
+    data->last_frame = now;
+    if (GST_CLOCK_TIME_IS_VALID (now) && now >= pts) {
+        guint64 latency = now - pts;
+        g_array_append_val (data->stats.latency, latency);
+    }
+}
+
+/* Count the packets reaching UDP_VIDEO_SINK, pushed one by one or as lists */
+static GstPadProbeReturn video_probe_cb (GstPad * pad, GstPadProbeInfo * info, HostData * data)
+{
+    GstClockTime now = get_running_time (data->udp_video_sink);
+
+    g_mutex_lock (&data->lock);
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+        account_video_buffer (data, GST_PAD_PROBE_INFO_BUFFER (info), now);
+    } else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+        guint len = gst_buffer_list_length (list);
+        for (guint i = 0; i < len; ++i) {
+            account_video_buffer (data, gst_buffer_list_get (list, i), now);
+        }
+    }
+    g_mutex_unlock (&data->lock);
+    return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn audio_probe_cb (GstPad * pad, GstPadProbeInfo * info, HostData * data)
+{
+    g_mutex_lock (&data->lock);
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+        data->stats.audio_packets++;
+    } else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+        data->stats.audio_packets += gst_buffer_list_length (GST_PAD_PROBE_INFO_BUFFER_LIST (info));
+    }
+    g_mutex_unlock (&data->lock);
+    return GST_PAD_PROBE_OK;
+}
+
+static gint compare_guint64 (gconstpointer a, gconstpointer b)
+{
+    guint64 x = *(const guint64 *) a, y = *(const guint64 *) b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void add_sink_probe (GstElement * sink, GstPadProbeCallback callback, HostData * data)
+{
+    GstPad *pad = gst_element_get_static_pad (sink, "sink");
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST, callback, data, NULL);
+    gst_object_unref (pad);
+}
+
+/*
+ * Public methods
+ */
+
+HostData * host_sender_new (const HostConfig * config, GError ** error)
+{
+    HostData *data;
+    gchar *description;
+
+    GST_DEBUG_CATEGORY_INIT (debug_category, TAG, 0, "DVBT2-SENDER (host)");
+
+    description = g_strdup_printf (PIPELINE_NAMI_HEADLESS,
+                                   config->width, config->height, config->framerate,
+                                   config->speed_preset, config->bitrate, config->key_int_max);
+    GST_DEBUG ("PIPELINE: %s", description);
+
+    data = g_new0 (HostData, 1);
+    g_mutex_init (&data->lock);
+    data->stats.latency = g_array_new (FALSE, FALSE, sizeof (guint64));
+    data->stats.jitter = g_array_new (FALSE, FALSE, sizeof (guint64));
+    data->last_pts = GST_CLOCK_TIME_NONE;
+    data->last_frame = GST_CLOCK_TIME_NONE;
+    data->frame_duration = gst_util_uint64_scale_int (GST_SECOND, 1, config->framerate);
+    data->pipeline = gst_parse_launch (description, error);
+    g_free (description);
+    if (!data->pipeline || (error && *error)) {
+        host_sender_free (data);
+        return NULL;
+    }
+
+    data->udp_video_sink = gst_bin_get_by_name (GST_BIN (data->pipeline), UDP_VIDEO_SINK);
+    data->udp_audio_sink = gst_bin_get_by_name (GST_BIN (data->pipeline), UDP_AUDIO_SINK);
+    if (!data->udp_video_sink || !data->udp_audio_sink) {
+        g_set_error (error, GST_CORE_ERROR, GST_CORE_ERROR_FAILED, "Could not retrieve udp sinks");
+        host_sender_free (data);
+        return NULL;
+    }
+
+    add_sink_probe (data->udp_video_sink, (GstPadProbeCallback) video_probe_cb, data);
+    add_sink_probe (data->udp_audio_sink, (GstPadProbeCallback) audio_probe_cb, data);
+    data->recorder = recorder_new (data->pipeline);
+
+    gst_element_set_state (data->pipeline, GST_STATE_READY);
+    return data;
+}
+
+void host_sender_free (HostData * data)
+{
+    if (!data)
+        return;
+
+    if (data->pipeline) {
+        gst_element_set_state (data->pipeline, GST_STATE_NULL);
+    }
+    /* Only once no streaming thread can run the recorder's tee probes */
+    recorder_free (data->recorder);
+    if (data->udp_video_sink) {
+        gst_object_unref (data->udp_video_sink);
+    }
+    if (data->udp_audio_sink) {
+        gst_object_unref (data->udp_audio_sink);
+    }
+    if (data->pipeline) {
+        gst_object_unref (data->pipeline);
+    }
+    g_array_unref (data->stats.latency);
+    g_array_unref (data->stats.jitter);
+    g_mutex_clear (&data->lock);
+    g_free (data);
+}
+
+void host_sender_add_client (HostData * data, const gchar * ip, gint port)
+{
+    g_signal_emit_by_name (G_OBJECT (data->udp_video_sink), "add", ip, port);
+    g_signal_emit_by_name (G_OBJECT (data->udp_audio_sink), "add", ip, port + 1);
+    GST_DEBUG ("Add Client: %s:%d", ip, port);
+}
+
+void host_sender_remove_client (HostData * data, const gchar * ip, gint port)
+{
+    g_signal_emit_by_name (G_OBJECT (data->udp_video_sink), "remove", ip, port);
+    g_signal_emit_by_name (G_OBJECT (data->udp_audio_sink), "remove", ip, port + 1);
+    GST_DEBUG ("Remove Client: %s:%d", ip, port);
+}
+
+void host_sender_clear_all_client (HostData * data)
+{
+    g_signal_emit_by_name (G_OBJECT (data->udp_video_sink), "clear");
+    g_signal_emit_by_name (G_OBJECT (data->udp_audio_sink), "clear");
+}
+
+gboolean host_sender_play (HostData * data)
+{
+    GST_DEBUG ("Setting state to PLAYING");
+    if (gst_element_set_state (data->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+        return FALSE;
+    return gst_element_get_state (data->pipeline, NULL, NULL, 5 * GST_SECOND) != GST_STATE_CHANGE_FAILURE;
+}
+
+void host_sender_reset_stats (HostData * data)
+{
+    g_mutex_lock (&data->lock);
+    data->stats.video_frames = 0;
+    data->stats.video_packets = 0;
+    data->stats.audio_packets = 0;
+    g_array_set_size (data->stats.latency, 0);
+    g_array_set_size (data->stats.jitter, 0);
+    g_mutex_unlock (&data->lock);
+}
+
+void host_sender_take_stats (HostData * data, HostStats * out)
+{
+    g_mutex_lock (&data->lock);
+    *out = data->stats;
+    data->stats.video_frames = 0;
+    data->stats.video_packets = 0;
+    data->stats.audio_packets = 0;
+    data->stats.latency = g_array_new (FALSE, FALSE, sizeof (guint64));
+    data->stats.jitter = g_array_new (FALSE, FALSE, sizeof (guint64));
+    g_mutex_unlock (&data->lock);
+}
+
+gchar * host_sender_pop_error (HostData * data)
+{
+    GstBus *bus = gst_element_get_bus (data->pipeline);
+    GstMessage *msg;
+    gchar *message_string = NULL;
+
+    while (!message_string && (msg = gst_bus_pop (bus))) {
+        /* Recording branch errors only stop the recording */
+        if (data->recorder && recorder_handle_message (data->recorder, msg)) {
+            gst_message_unref (msg);
+            continue;
+        }
+        if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+            GError *err;
+            gchar *debug_info;
+            gst_message_parse_error (msg, &err, &debug_info);
+            message_string = g_strdup_printf ("Error received from element %s: %s", GST_OBJECT_NAME (msg->src), err->message);
+            g_clear_error (&err);
+            g_free (debug_info);
+        }
+        gst_message_unref (msg);
+    }
+    gst_object_unref (bus);
+    return message_string;
+}
+
+gchar * host_sender_run_for (HostData * data, gint seconds)
+{
+    gint64 end = g_get_monotonic_time () + (gint64) seconds * G_USEC_PER_SEC;
+    gchar *error;
+
+    while (g_get_monotonic_time () < end) {
+        if ((error = host_sender_pop_error (data)))
+            return error;
+        g_usleep (BUS_POLL_MS * 1000);
+    }
+    return NULL;
+}
+
+void host_sort_samples (GArray * samples)
+{
+    g_array_sort (samples, compare_guint64);
+}
+
+gdouble host_percentile_ms (GArray * samples, gdouble p)
+{
+    guint rank;
+
+    if (samples->len == 0)
+        return -1.0;
+    rank = (guint) (p * samples->len + 0.999999);
+    rank = CLAMP (rank, 1, samples->len);
+    return g_array_index (samples, guint64, rank - 1) / (gdouble) GST_MSECOND;
+}
+
+int host_open_loopback_socket (gint port)
+{
+    struct sockaddr_in addr;
+    int rcvbuf = LOOPBACK_RCVBUF;
+    int fd = socket (AF_INET, SOCK_DGRAM, 0);
+
+    if (fd < 0)
+        return -1;
+    setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof (rcvbuf));
+    memset (&addr, 0, sizeof (addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons (port);
+    inet_pton (AF_INET, LOOPBACK_IP, &addr.sin_addr);
+    if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0) {
+        close (fd);
+        return -1;
+    }
+    return fd;
+}
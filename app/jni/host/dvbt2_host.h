@@ -0,0 +1,84 @@
+#ifndef NAMIDTVBT2EXAMPLE_DVBT2_HOST_H
+#define NAMIDTVBT2EXAMPLE_DVBT2_HOST_H
+
+#include <gst/gst.h>
+#include "dvbt2_pipeline.h"
+#include "dvbt2_record.h"
+
+#define LOOPBACK_IP "127.0.0.1"
+
+/**
+ * Linux host build of the sender pipeline (PIPELINE_NAMI_HEADLESS).
+ * No JNI, no surfaces: the pipeline is driven directly by the caller (see dvbt2_bench.c).
+ */
+
+/* Encoder and source settings used to fill PIPELINE_NAMI_HEADLESS */
+typedef struct _HostConfig {
+    gint width;
+    gint height;
+    gint framerate;
+    const gchar *speed_preset;  /* x264enc speed-preset nick, e.g. "ultrafast" */
+    gint bitrate;               /* x264enc bitrate in kbit/s */
+    gint key_int_max;           /* x264enc key-int-max, 0 = encoder default */
+} HostConfig;
+
+/* Counters collected on the multiudpsink sink pads since the last host_sender_reset_stats() */
+typedef struct _HostStats {
+    guint64 video_frames;       /* Encoded frames handed to the video multiudpsink */
+    guint64 video_packets;      /* RTP packets handed to the video multiudpsink */
+    guint64 audio_packets;      /* RTP packets handed to the audio multiudpsink */
+    GArray *latency;            /* guint64 ns per frame: capture (PTS) -> video multiudpsink */
+    GArray *jitter;             /* guint64 ns per frame: |frame interval - 1/framerate| at the video multiudpsink */
+} HostStats;
+
+typedef struct _HostData {
+    GstElement *pipeline;
+    GstElement *udp_video_sink;
+    GstElement *udp_audio_sink;
+    GMutex lock;                /* Protects stats, written from the streaming threads */
+    HostStats stats;
+    GstClockTime last_pts;      /* PTS of the last video frame seen, RTP packets of one frame share it */
+    GstClockTime last_frame;    /* Running time the last video frame reached the sink */
+    GstClockTime frame_duration;
+    Recorder *recorder;         /* Recording branch control, bus messages are routed to it */
+} HostData;
+
+/* Build the headless pipeline for the given config. Returns NULL and sets error on failure */
+HostData * host_sender_new (const HostConfig * config, GError ** error);
+
+/* Stop the pipeline and free all resources */
+void host_sender_free (HostData * data);
+
+/* Same port convention as gst_native_add_client: video on port, audio on port+1 */
+void host_sender_add_client (HostData * data, const gchar * ip, gint port);
+
+void host_sender_remove_client (HostData * data, const gchar * ip, gint port);
+
+void host_sender_clear_all_client (HostData * data);
+
+/* Set pipeline to PLAYING and wait for the state change to complete */
+gboolean host_sender_play (HostData * data);
+
+/* Drop all counters collected so far (e.g. at the end of a warm-up period) */
+void host_sender_reset_stats (HostData * data);
+
+/* Move the collected counters into out (caller frees out->latency and out->jitter) and reset them */
+void host_sender_take_stats (HostData * data, HostStats * out);
+
+/* Dispatch pending bus messages (recording branch included) and return the first pipeline error,
+ * if any. Caller frees the returned message */
+gchar * host_sender_pop_error (HostData * data);
+
+/* Sleep for seconds while watching the bus. Returns the first error message, if any (caller frees) */
+gchar * host_sender_run_for (HostData * data, gint seconds);
+
+/* Sort an array of guint64 ns samples, needed before host_percentile_ms */
+void host_sort_samples (GArray * samples);
+
+/* Nearest-rank percentile (p in 0..1) of sorted ns samples, in ms. -1 when empty */
+gdouble host_percentile_ms (GArray * samples, gdouble p);
+
+/* UDP socket bound to 127.0.0.1:port with a large receive buffer, -1 on failure */
+int host_open_loopback_socket (gint port);
+
+#endif //NAMIDTVBT2EXAMPLE_DVBT2_HOST_H
@@ -0,0 +1,356 @@
+/*
+ * Glass-to-glass latency measurement over loopback.
+ *
+ * Runs the headless sender with the absolute capture time extension enabled (dvbt2_abs_capture.h)
+ * and one loopback receiver. Fails unless the payloader caps advertise extmap-<ext-id> for it. For every video frame that completes at the receiver (RTP marker bit)
+ * the capture time carried in the extension gives the sender -> receiver latency, and the sender
+ * side timing kept by the probe splits it into:
+ *   capture   capture timestamp -> frame reaches the tee
+ *   queue     tee -> encoder input (queue + videoconvert)
+ *   encode    encoder input -> encoder output
+ *   payload   encoder output -> last RTP packet of the frame leaves rtph264pay
+ *   sink_wait rtph264pay -> render time of the frame: multiudpsink (sync=true) holds each packet until
+ *             capture + pipeline latency (queried once after the warm-up, reported as pipeline_latency_ms)
+ *   network   render time (or rtph264pay, if the frame is late) -> receiver socket
+ *
+ * Writes one JSON object with p50/p90/p99/max per stage, and with --frames one JSON line per frame.
+ *
+ * Example:
+ *   ./build/dvbt2_latency --resolution=1280x720 --framerate=30 --duration=30 --frames=frames.jsonl
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "dvbt2_abs_capture.h"
+#include "dvbt2_host.h"
+
+#define RECEIVER_POLL_MS 100
+
+typedef enum _Stage {
+    STAGE_TOTAL,
+    STAGE_CAPTURE,
+    STAGE_QUEUE,
+    STAGE_ENCODE,
+    STAGE_PAYLOAD,
+    STAGE_SINK_WAIT,
+    STAGE_NETWORK,
+    STAGE_MAX,
+} Stage;
+
+static const gchar *stage_name[STAGE_MAX] = {
+        "total", "capture", "queue", "encode", "payload", "sink_wait", "network",
+};
+
+typedef struct _LatencyReceiver {
+    pthread_t thread;
+    int fd[2];                  /* Video on port, audio on port+1 (drained only) */
+    gint stop;
+    gint measuring;             /* Samples are only kept after the warm-up */
+    AbsCaptureProbe *probe;
+    guint8 ext_id;
+    GstClockTime latency;       /* Pipeline latency, set before measuring starts */
+    GMutex lock;
+    GArray *samples[STAGE_MAX]; /* guint64 ns per frame */
+    guint64 missing;            /* Frames without the extension */
+    FILE *frames_out;
+} LatencyReceiver;
+
+static gchar *opt_resolution = "1280x720";
+static gint opt_framerate = 30;
+static gchar *opt_preset = "ultrafast";
+static gint opt_bitrate = 2048;
+static gint opt_key_int_max = 0;
+static gint opt_duration = 10;
+static gint opt_warmup = 2;
+static gint opt_port = 5000;
+static gint opt_ext_id = ABS_CAPTURE_TIME_EXT_ID;
+static gchar *opt_frames = NULL;
+static gchar *opt_output = NULL;
+
+static GOptionEntry entries[] = {
+        {"resolution", 'r', 0, G_OPTION_ARG_STRING, &opt_resolution, "WxH", "WxH"},
+        {"framerate", 'f', 0, G_OPTION_ARG_INT, &opt_framerate, "Framerate", "N"},
+        {"preset", 'p', 0, G_OPTION_ARG_STRING, &opt_preset, "x264enc speed-preset", "NAME"},
+        {"bitrate", 'b', 0, G_OPTION_ARG_INT, &opt_bitrate, "x264enc bitrate (kbit/s)", "N"},
+        {"key-int-max", 'k', 0, G_OPTION_ARG_INT, &opt_key_int_max, "x264enc key-int-max (0 = encoder default)", "N"},
+        {"duration", 'd', 0, G_OPTION_ARG_INT, &opt_duration, "Measured seconds", "S"},
+        {"warmup", 'w', 0, G_OPTION_ARG_INT, &opt_warmup, "Unmeasured seconds before the measurement", "S"},
+        {"port", 0, 0, G_OPTION_ARG_INT, &opt_port, "Loopback video port, audio uses port+1", "PORT"},
+        {"ext-id", 0, 0, G_OPTION_ARG_INT, &opt_ext_id, "RTP header extension id (1-14)", "ID"},
+        {"frames", 0, 0, G_OPTION_ARG_FILENAME, &opt_frames, "Write one JSON line per frame here", "FILE"},
+        {"output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output, "Write the summary here instead of stdout", "FILE"},
+        {NULL}
+};
+
+/*
+ * Receiver
+ */
+
+static guint64 span (guint64 from, guint64 to)
+{
+    return (from && to > from) ? to - from : 0;
+}
+
+/* A frame completed at the receiver: record total latency and, if the sender still knows it, the stages */
+static void frame_received (LatencyReceiver * receiver, guint64 capture, guint64 arrival)
+{
+    FrameTiming timing;
+    guint64 stage[STAGE_MAX] = {0};
+    gboolean breakdown;
+
+    stage[STAGE_TOTAL] = span (capture, arrival);
+    breakdown = abs_capture_probe_lookup (receiver->probe, capture, &timing) && timing.payload_out;
+    if (breakdown) {
+        guint64 render = timing.capture + receiver->latency;
+        stage[STAGE_CAPTURE] = span (timing.capture, timing.source);
+        stage[STAGE_QUEUE] = span (timing.source, timing.encoder_in);
+        stage[STAGE_ENCODE] = span (timing.encoder_in, timing.encoder_out);
+        stage[STAGE_PAYLOAD] = span (timing.encoder_out, timing.payload_out);
+        stage[STAGE_SINK_WAIT] = span (timing.payload_out, render);
+        stage[STAGE_NETWORK] = span (MAX (timing.payload_out, render), arrival);
+    }
+
+    g_mutex_lock (&receiver->lock);
+    g_array_append_val (receiver->samples[STAGE_TOTAL], stage[STAGE_TOTAL]);
+    if (breakdown) {
+        for (int i = STAGE_CAPTURE; i < STAGE_MAX; ++i) {
+            g_array_append_val (receiver->samples[i], stage[i]);
+        }
+    }
+    if (receiver->frames_out) {
+        fprintf (receiver->frames_out, "{\"capture_ns\":%" G_GUINT64_FORMAT, capture);
+        for (int i = 0; i < STAGE_MAX; ++i) {
+            if (i == STAGE_TOTAL || breakdown)
+                fprintf (receiver->frames_out, ",\"%s_ms\":%.3f", stage_name[i], stage[i] / (gdouble) GST_MSECOND);
+        }
+        fprintf (receiver->frames_out, "}\n");
+    }
+    g_mutex_unlock (&receiver->lock);
+}
+
+static void * receiver_function (void *userdata)
+{
+    LatencyReceiver *receiver = (LatencyReceiver *) userdata;
+    struct pollfd pfd[2] = {
+            {receiver->fd[0], POLLIN, 0},
+            {receiver->fd[1], POLLIN, 0},
+    };
+    guint8 packet[65536];
+    ssize_t size;
+
+    while (!g_atomic_int_get (&receiver->stop)) {
+        if (poll (pfd, 2, RECEIVER_POLL_MS) <= 0)
+            continue;
+        if (pfd[1].revents & POLLIN) {
+            while (recv (pfd[1].fd, packet, sizeof (packet), MSG_DONTWAIT) >= 0);
+        }
+        if (!(pfd[0].revents & POLLIN))
+            continue;
+        while ((size = recv (pfd[0].fd, packet, sizeof (packet), MSG_DONTWAIT)) >= 0) {
+            guint64 arrival = abs_capture_wall_clock ();
+            guint64 capture;
+            gboolean marker = FALSE;
+            gboolean found;
+
+            if (!g_atomic_int_get (&receiver->measuring))
+                continue;
+            found = abs_capture_parse_packet (packet, size, receiver->ext_id, &capture, &marker);
+            if (!marker)
+                continue;
+            if (found) {
+                frame_received (receiver, capture, arrival);
+            } else {
+                g_mutex_lock (&receiver->lock);
+                receiver->missing++;
+                g_mutex_unlock (&receiver->lock);
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Id of the extmap-<id> field carrying ABS_CAPTURE_TIME_URI in the caps reaching the video sink, 0 if none.
+ * This is what a receiver would take from the SDP */
+static gint advertised_ext_id (HostData * data)
+{
+    GstPad *pad = gst_element_get_static_pad (data->udp_video_sink, "sink");
+    GstCaps *caps = gst_pad_get_current_caps (pad);
+    gint ext_id = 0;
+
+    gst_object_unref (pad);
+    if (!caps)
+        return 0;
+    for (gint id = 1; id <= 14 && !ext_id; ++id) {
+        gchar *field = g_strdup_printf ("extmap-%d", id);
+        if (g_strcmp0 (gst_structure_get_string (gst_caps_get_structure (caps, 0), field), ABS_CAPTURE_TIME_URI) == 0)
+            ext_id = id;
+        g_free (field);
+    }
+    gst_caps_unref (caps);
+    return ext_id;
+}
+
+/* Latency the sinks sync to, known once the pipeline is playing */
+static gboolean query_latency (HostData * data, GstClockTime * latency)
+{
+    GstQuery *query = gst_query_new_latency ();
+    gboolean ok = gst_element_query (data->pipeline, query);
+
+    if (ok)
+        gst_query_parse_latency (query, NULL, latency, NULL);
+    gst_query_unref (query);
+    return ok;
+}
+
+/*
+ * Report
+ */
+
+static void write_summary (FILE * out, const HostConfig * config, LatencyReceiver * receiver, const gchar * error)
+{
+    gchar *escaped = error ? g_strescape (error, NULL) : NULL;
+
+    fprintf (out, "{\"width\":%d,\"height\":%d,\"framerate\":%d,\"speed_preset\":\"%s\",\"bitrate_kbps\":%d,"
+                  "\"key_int_max\":%d,\"pipeline_latency_ms\":%.3f,\"frames\":%u,\"breakdown_frames\":%u,"
+                  "\"missing\":%" G_GUINT64_FORMAT,
+             config->width, config->height, config->framerate, config->speed_preset, config->bitrate,
+             config->key_int_max, receiver->latency / (gdouble) GST_MSECOND, receiver->samples[STAGE_TOTAL]->len,
+             receiver->samples[STAGE_CAPTURE]->len, receiver->missing);
+    for (int i = 0; i < STAGE_MAX; ++i) {
+        GArray *samples = receiver->samples[i];
+        host_sort_samples (samples);
+        fprintf (out, ",\"%s\":{\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f}", stage_name[i],
+                 host_percentile_ms (samples, 0.50), host_percentile_ms (samples, 0.90),
+                 host_percentile_ms (samples, 0.99), host_percentile_ms (samples, 1.0));
+    }
+    if (escaped)
+        fprintf (out, ",\"error\":\"%s\"}\n", escaped);
+    else
+        fprintf (out, ",\"error\":null}\n");
+    fflush (out);
+    g_free (escaped);
+}
+
+int main (int argc, char *argv[])
+{
+    GOptionContext *context = g_option_context_new ("- measure glass-to-glass latency of the dvbt2 sender pipeline");
+    GError *err = NULL;
+    HostConfig config = {0};
+    LatencyReceiver receiver = {0};
+    HostData *data = NULL;
+    gchar *error = NULL;
+    gboolean receiving = FALSE;
+    FILE *out = stdout;
+    int ret;
+
+    g_option_context_add_main_entries (context, entries, NULL);
+    g_option_context_add_group (context, gst_init_get_option_group ());
+    if (!g_option_context_parse (context, &argc, &argv, &err)) {
+        g_printerr ("%s\n", err->message);
+        g_clear_error (&err);
+        g_option_context_free (context);
+        return 2;
+    }
+    g_option_context_free (context);
+
+    if (sscanf (opt_resolution, "%dx%d", &config.width, &config.height) != 2
+        || opt_framerate <= 0 || opt_duration <= 0 || opt_warmup < 0 || opt_ext_id < 1 || opt_ext_id > 14) {
+        g_printerr ("Invalid resolution, framerate, duration, warmup or ext-id\n");
+        return 2;
+    }
+    config.framerate = opt_framerate;
+    config.speed_preset = opt_preset;
+    config.bitrate = opt_bitrate;
+    config.key_int_max = opt_key_int_max;
+
+    if (opt_output && !(out = fopen (opt_output, "w"))) {
+        g_printerr ("Could not open %s: %s\n", opt_output, g_strerror (errno));
+        return 2;
+    }
+    if (opt_frames && !(receiver.frames_out = fopen (opt_frames, "w"))) {
+        g_printerr ("Could not open %s: %s\n", opt_frames, g_strerror (errno));
+        return 2;
+    }
+
+    g_mutex_init (&receiver.lock);
+    for (int i = 0; i < STAGE_MAX; ++i) {
+        receiver.samples[i] = g_array_new (FALSE, FALSE, sizeof (guint64));
+    }
+    receiver.ext_id = (guint8) opt_ext_id;
+
+    if (!(data = host_sender_new (&config, &err))) {
+        error = g_strdup_printf ("Unable to build pipeline: %s", err ? err->message : "unknown");
+        g_clear_error (&err);
+        goto done;
+    }
+    if (!(receiver.probe = abs_capture_probe_new (data->pipeline, receiver.ext_id))) {
+        error = g_strdup ("Unable to install the latency probe");
+        goto done;
+    }
+    abs_capture_probe_set_active (receiver.probe, TRUE);
+
+    receiver.fd[0] = host_open_loopback_socket (opt_port);
+    receiver.fd[1] = host_open_loopback_socket (opt_port + 1);
+    if (receiver.fd[0] < 0 || receiver.fd[1] < 0) {
+        error = g_strdup_printf ("Could not bind %s:%d/%d: %s", LOOPBACK_IP, opt_port, opt_port + 1, g_strerror (errno));
+        if (receiver.fd[0] >= 0)
+            close (receiver.fd[0]);
+        if (receiver.fd[1] >= 0)
+            close (receiver.fd[1]);
+        goto done;
+    }
+    pthread_create (&receiver.thread, NULL, &receiver_function, &receiver);
+    receiving = TRUE;
+    host_sender_add_client (data, LOOPBACK_IP, opt_port);
+
+    if (!host_sender_play (data)) {
+        error = host_sender_pop_error (data);
+        if (!error)
+            error = g_strdup ("Unable to set the pipeline to the playing state");
+        goto done;
+    }
+    if ((error = host_sender_run_for (data, opt_warmup)))
+        goto done;
+    if (advertised_ext_id (data) != receiver.ext_id) {
+        error = g_strdup_printf ("extmap-%d=%s not advertised in the payloader caps", receiver.ext_id, ABS_CAPTURE_TIME_URI);
+        goto done;
+    }
+    if (!query_latency (data, &receiver.latency)) {
+        error = g_strdup ("Unable to query the pipeline latency");
+        goto done;
+    }
+    g_atomic_int_set (&receiver.measuring, 1);
+    error = host_sender_run_for (data, opt_duration);
+    g_atomic_int_set (&receiver.measuring, 0);
+
+done:
+    if (receiving) {
+        g_atomic_int_set (&receiver.stop, 1);
+        pthread_join (receiver.thread, NULL);
+        close (receiver.fd[0]);
+        close (receiver.fd[1]);
+    }
+    /* Probes may run until the pipeline is down */
+    host_sender_free (data);
+    abs_capture_probe_free (receiver.probe);
+
+    write_summary (out, &config, &receiver, error);
+    if (error)
+        g_printerr ("%s\n", error);
+
+    if (receiver.frames_out)
+        fclose (receiver.frames_out);
+    if (out != stdout)
+        fclose (out);
+    for (int i = 0; i < STAGE_MAX; ++i) {
+        g_array_unref (receiver.samples[i]);
+    }
+    g_mutex_clear (&receiver.lock);
+    ret = error ? 1 : 0;
+    g_free (error);
+    return ret;
+}
@@ -22,6 +22,9 @@ class DvbSenderManager(private val callback: DvbSenderManagerCallback) {
     private external fun nativeStopBroadcast(ip: String, port: Int)
     private external fun nativeStartVideoTest()
     private external fun nativeStopVideoTest()
+    private external fun nativeSetCaptureTimestamp(enable: Boolean)
+    private external fun nativeStartRecord(location: String, format: Int, maxSeconds: Int, maxMegabytes: Int)
+    private external fun nativeStopRecord()
 
     private val nativeCustomData: Long = 0 // Native code will use this to keep private data
     private var mCameraEnabled: Boolean = false
@@ -99,6 +102,21 @@ class DvbSenderManager(private val callback: DvbSenderManagerCallback) {
         nativeStopVideoTest()
     }
 
+    // Attach the capture wall-clock time to each video RTP packet (abs-capture-time header extension)
+    fun setCaptureTimestamp(enable: Boolean) {
+        nativeSetCaptureTimestamp(enable)
+    }
+
+    // Record the broadcast into segments, location is a file pattern with one %d (e.g. "dvbt2_%05d.mp4")
+    fun startRecord(location: String, format: Int = RECORD_FORMAT_MP4, maxSeconds: Int = 60, maxMegabytes: Int = 0) {
+        nativeStartRecord(location, format, maxSeconds, maxMegabytes)
+    }
+
+    // Stops at the next keyframe, the live stream is not interrupted
+    fun stopRecord() {
+        nativeStopRecord()
+    }
+
     /* Native Call Back
      * Called from native code. This sets the content of the TextView from the UI thread.
     */
@@ -123,6 +141,9 @@ class DvbSenderManager(private val callback: DvbSenderManagerCallback) {
         // Define for meanning of screen id
         const val SURFACE_FMMW = 0
         const val SURFACE_DW   = 1
+        // Recording container, same values as RecordFormat in dvbt2_record.h
+        const val RECORD_FORMAT_MP4 = 0
+        const val RECORD_FORMAT_TS  = 1
         // Broadcast receiver handle
         const val ACTION_ID_CALL_PLAY              = 1996
         const val ACTION_ID_CALL_PAUSE             = 1997